@@ -0,0 +1,217 @@
+#include <cstdio>
+#include <string>
+#include <cstring>
+
+extern "C" {
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+}
+
+#include "cache.hpp"
+
+#define LONG_BITS (sizeof(unsigned long) * 8)
+#define NLONGS(bits) (((bits)-1) / LONG_BITS + 1)
+
+// bump whenever the layout changes, stale entries then simply miss
+static constexpr uint32_t cache_version = 1;
+
+struct cached_description {
+    char magic[8];
+    uint32_t version;
+    uint32_t size;
+    char name[256];
+    char uniq[256];
+    int32_t product, vendor, bustype, id_version;
+    unsigned long properties[NLONGS(INPUT_PROP_CNT)];
+    unsigned long types[NLONGS(EV_CNT)];
+    unsigned long codes[EV_CNT][NLONGS(KEY_CNT)];
+    input_absinfo absinfo[ABS_CNT];
+    int32_t repeat[REP_CNT];
+};
+
+static bool test_bit(const unsigned long bits[], unsigned bit) {
+    return bits[bit / LONG_BITS] & (1UL << (bit % LONG_BITS));
+}
+
+static void set_bit(unsigned long bits[], unsigned bit) {
+    bits[bit / LONG_BITS] |= 1UL << (bit % LONG_BITS);
+}
+
+void description_hash::add(const void *data, size_t size) {
+    for (auto p = static_cast<const unsigned char *>(data); size--; ++p)
+        state = (state ^ *p) * UINT64_C(1099511628211);
+}
+
+bool description_hash::add_file(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    add("c", 1);
+    char buffer[4096];
+    ssize_t n;
+    while ((n = read(fd, buffer, sizeof buffer)) > 0)
+        add(buffer, n);
+    close(fd);
+
+    return n == 0;
+}
+
+bool description_hash::add_device(const char *devnode) {
+    int fd = open(devnode, O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    add("d", 1);
+
+    input_id id;
+    int version;
+    char name[256] = {}, uniq[256] = {};
+    unsigned long properties[NLONGS(INPUT_PROP_CNT)] = {};
+    unsigned long types[NLONGS(EV_CNT)]              = {};
+    bool ok = ioctl(fd, EVIOCGID, &id) >= 0 &&
+              ioctl(fd, EVIOCGVERSION, &version) >= 0 &&
+              ioctl(fd, EVIOCGNAME(sizeof name - 1), name) >= 0 &&
+              ioctl(fd, EVIOCGBIT(0, sizeof types), types) >= 0;
+    // optional ones, not every device has them
+    ioctl(fd, EVIOCGUNIQ(sizeof uniq - 1), uniq);
+    ioctl(fd, EVIOCGPROP(sizeof properties), properties);
+
+    add(&id, sizeof id);
+    add(&version, sizeof version);
+    add(name, sizeof name);
+    add(uniq, sizeof uniq);
+    add(properties, sizeof properties);
+    add(types, sizeof types);
+
+    for (unsigned type = 1; ok && type < EV_CNT; ++type) {
+        if (!test_bit(types, type))
+            continue;
+
+        unsigned long codes[NLONGS(KEY_CNT)] = {};
+        ok = ioctl(fd, EVIOCGBIT(type, sizeof codes), codes) >= 0;
+        add(codes, sizeof codes);
+
+        if (type == EV_ABS)
+            for (unsigned code = 0; ok && code < ABS_CNT; ++code) {
+                if (!test_bit(codes, code))
+                    continue;
+                input_absinfo absinfo;
+                ok = ioctl(fd, EVIOCGABS(code), &absinfo) >= 0;
+                absinfo.value = 0;
+                add(&absinfo, sizeof absinfo);
+            }
+        else if (type == EV_REP) {
+            unsigned int repeat[2] = {};
+            ok = ioctl(fd, EVIOCGREP, repeat) >= 0;
+            add(repeat, sizeof repeat);
+        }
+    }
+    close(fd);
+
+    return ok;
+}
+
+libevdev *evdev_create_from_cache(const std::string &path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return nullptr;
+
+    static cached_description cached;
+    ssize_t n = read(fd, &cached, sizeof cached);
+    close(fd);
+    if (n != sizeof cached || std::memcmp(cached.magic, "EVDEVDSC", 8) ||
+        cached.version != cache_version || cached.size != sizeof cached)
+        return nullptr;
+    cached.name[sizeof cached.name - 1] = '\0';
+    cached.uniq[sizeof cached.uniq - 1] = '\0';
+
+    libevdev *dev = libevdev_new();
+
+    if (*cached.name)
+        libevdev_set_name(dev, cached.name);
+    if (*cached.uniq)
+        libevdev_set_uniq(dev, cached.uniq);
+    libevdev_set_id_product(dev, cached.product);
+    libevdev_set_id_vendor(dev, cached.vendor);
+    libevdev_set_id_bustype(dev, cached.bustype);
+    libevdev_set_id_version(dev, cached.id_version);
+
+    for (unsigned property = 0; property < INPUT_PROP_CNT; ++property)
+        if (test_bit(cached.properties, property))
+            libevdev_enable_property(dev, property);
+
+    for (unsigned type = 0; type < EV_CNT; ++type) {
+        if (!test_bit(cached.types, type))
+            continue;
+        libevdev_enable_event_type(dev, type);
+        int max = libevdev_event_type_get_max(type);
+        for (int code = 0; code <= max; ++code) {
+            if (!test_bit(cached.codes[type], code))
+                continue;
+            const void *data = nullptr;
+            if (type == EV_ABS)
+                data = &cached.absinfo[code];
+            else if (type == EV_REP)
+                data = &cached.repeat[code];
+            libevdev_enable_event_code(dev, type, code, data);
+        }
+    }
+
+    return dev;
+}
+
+// Written to a temporary file first and renamed over, so that concurrent
+// starts never read a partial entry.
+bool cache_create_from_evdev(const std::string &path, const libevdev *dev) {
+    static cached_description cached;
+    std::memset(&cached, 0, sizeof cached);
+    std::memcpy(cached.magic, "EVDEVDSC", 8);
+    cached.version = cache_version;
+    cached.size    = sizeof cached;
+
+    if (auto name = libevdev_get_name(dev))
+        std::strncpy(cached.name, name, sizeof cached.name - 1);
+    if (auto uniq = libevdev_get_uniq(dev))
+        std::strncpy(cached.uniq, uniq, sizeof cached.uniq - 1);
+    cached.product    = libevdev_get_id_product(dev);
+    cached.vendor     = libevdev_get_id_vendor(dev);
+    cached.bustype    = libevdev_get_id_bustype(dev);
+    cached.id_version = libevdev_get_id_version(dev);
+
+    for (unsigned property = 0; property < INPUT_PROP_CNT; ++property)
+        if (libevdev_has_property(dev, property))
+            set_bit(cached.properties, property);
+
+    for (unsigned type = 0; type < EV_CNT; ++type) {
+        if (!libevdev_has_event_type(dev, type))
+            continue;
+        set_bit(cached.types, type);
+        int max = libevdev_event_type_get_max(type);
+        for (int code = 0; code <= max; ++code) {
+            if (!libevdev_has_event_code(dev, type, code))
+                continue;
+            set_bit(cached.codes[type], code);
+            if (type == EV_ABS) {
+                if (auto absinfo = libevdev_get_abs_info(dev, code))
+                    cached.absinfo[code] = *absinfo;
+            } else if (type == EV_REP)
+                cached.repeat[code] =
+                    libevdev_get_event_value(dev, EV_REP, code);
+        }
+    }
+
+    std::string temporary = path + "." + std::to_string(getpid());
+    int fd = open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return false;
+    bool ok = write(fd, &cached, sizeof cached) == sizeof cached;
+    ok      = close(fd) == 0 && ok;
+    if (!ok || std::rename(temporary.c_str(), path.c_str()) < 0) {
+        unlink(temporary.c_str());
+        return false;
+    }
+
+    return true;
+}
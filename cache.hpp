@@ -0,0 +1,27 @@
+#ifndef INTERCEPTION_CACHE_HPP
+#define INTERCEPTION_CACHE_HPP
+
+#include <string>
+#include <cstdint>
+
+#include <libevdev/libevdev.h>
+
+// FNV-1a hash of the inputs a device description gets merged from: YAML file
+// contents and reference device identities and capabilities. Current axis
+// values are left out, since they don't make a different device.
+class description_hash {
+    uint64_t state = UINT64_C(14695981039346656037);
+
+public:
+    void add(const void *data, size_t size);
+    bool add_file(const char *path);
+    bool add_device(const char *devnode);
+    uint64_t value() const { return state; }
+};
+
+// Compiled device descriptions, the capability bitmasks and absinfo of a
+// merged device stored as is so that it can be recreated without YAML.
+libevdev *evdev_create_from_cache(const std::string &path);
+bool cache_create_from_evdev(const std::string &path, const libevdev *dev);
+
+#endif
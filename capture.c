@@ -0,0 +1,192 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <linux/input.h>
+
+#include "capture.h"
+
+static int write_all(int fd, const void *data, size_t size) {
+    for (const char *p = data; size;) {
+        ssize_t written = write(fd, p, size);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        p += written;
+        size -= written;
+    }
+
+    return 0;
+}
+
+static uint32_t padded(size_t size) { return (size + 8) & ~(size_t)7; }
+
+int capture_write_header(int fd, const char *description) {
+    size_t length                = strlen(description);
+    struct capture_header header = {.version          = CAPTURE_VERSION,
+                                    .description_size = padded(length)};
+    memcpy(header.magic, CAPTURE_MAGIC, sizeof header.magic);
+
+    static const char zeros[8];
+    if (write_all(fd, &header, sizeof header) < 0 ||
+        write_all(fd, description, length) < 0 ||
+        write_all(fd, zeros, header.description_size - length) < 0)
+        return -1;
+
+    return 0;
+}
+
+// Appends the index after the events, then fills in the header fields that
+// tell readers the capture is complete.
+int capture_write_index(int fd, uint64_t event_count,
+                        const struct capture_frame *frames,
+                        uint64_t frame_count) {
+    off_t offset = lseek(fd, 0, SEEK_END);
+    if (offset < 0 || write_all(fd, frames, frame_count * sizeof *frames) < 0)
+        return -1;
+
+    struct capture_header header;
+    if (pread(fd, &header, sizeof header, 0) != sizeof header)
+        return -1;
+    header.event_count  = event_count;
+    header.index_offset = offset;
+    header.frame_count  = frame_count;
+    if (pwrite(fd, &header, sizeof header, 0) != sizeof header)
+        return -1;
+
+    return fdatasync(fd);
+}
+
+// Orders frames by time, and by position for frames ending at the same time.
+static int compare_frames(const void *a, const void *b) {
+    const struct capture_frame *x = a, *y = b;
+    if (x->time != y->time)
+        return x->time < y->time ? -1 : 1;
+    return x->first < y->first ? -1 : x->first > y->first;
+}
+
+static int rebuild_index(struct capture *capture) {
+    uint64_t count = 0;
+    for (uint64_t i = 0; i < capture->event_count; ++i)
+        if (capture->events[i].type == EV_SYN &&
+            capture->events[i].code == SYN_REPORT)
+            ++count;
+
+    struct capture_frame *frames = malloc((count ? count : 1) * sizeof *frames);
+    if (!frames)
+        return -1;
+
+    uint64_t first = 0, frame = 0;
+    for (uint64_t i = 0; i < capture->event_count; ++i)
+        if (capture->events[i].type == EV_SYN &&
+            capture->events[i].code == SYN_REPORT) {
+            frames[frame++] = (struct capture_frame){
+                .time = capture->events[i].time, .first = first};
+            first = i + 1;
+        }
+    qsort(frames, count, sizeof *frames, compare_frames);
+
+    capture->rebuilt_frames = frames;
+    capture->frames         = frames;
+    capture->frame_count    = count;
+
+    return 0;
+}
+
+int capture_open(struct capture *capture, const char *path) {
+    memset(capture, 0, sizeof *capture);
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return -1;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    capture->size = st.st_size;
+    capture->map  = MAP_FAILED;
+    if (capture->size >= sizeof(struct capture_header))
+        capture->map =
+            mmap(NULL, capture->size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (capture->map == MAP_FAILED) {
+        capture->map = NULL;
+        errno        = EINVAL;
+        return -1;
+    }
+
+    const struct capture_header *header = capture->map;
+    uint64_t events_offset =
+        sizeof *header + (uint64_t)header->description_size;
+    if (memcmp(header->magic, CAPTURE_MAGIC, sizeof header->magic) ||
+        header->version != CAPTURE_VERSION ||
+        header->description_size % 8 || events_offset > capture->size)
+        goto invalid;
+
+    const char *base = capture->map;
+    if (!header->description_size || base[events_offset - 1])
+        goto invalid;
+
+    capture->description = base + sizeof *header;
+    capture->events      = (const struct capture_event *)(base + events_offset);
+
+    if (!header->index_offset) {
+        capture->event_count = (capture->size - events_offset) /
+                               sizeof(struct capture_event);
+        if (rebuild_index(capture) < 0)
+            goto fail;
+        return 0;
+    }
+
+    if (header->index_offset <
+            events_offset + header->event_count * sizeof *capture->events ||
+        header->index_offset +
+                header->frame_count * sizeof *capture->frames >
+            capture->size)
+        goto invalid;
+
+    capture->event_count = header->event_count;
+    capture->frames =
+        (const struct capture_frame *)(base + header->index_offset);
+    capture->frame_count = header->frame_count;
+
+    return 0;
+
+invalid:
+    errno = EINVAL;
+fail:
+    capture_close(capture);
+    return -1;
+}
+
+void capture_close(struct capture *capture) {
+    free(capture->rebuilt_frames);
+    if (capture->map)
+        munmap(capture->map, capture->size);
+    memset(capture, 0, sizeof *capture);
+}
+
+// Position in the index of the first frame ending at or after the given time,
+// frame_count if there's none.
+uint64_t capture_find_frame(const struct capture *capture, int64_t time) {
+    uint64_t low = 0, high = capture->frame_count;
+    while (low < high) {
+        uint64_t middle = low + (high - low) / 2;
+        if (capture->frames[middle].time < time)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+
+    return low;
+}
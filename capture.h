@@ -0,0 +1,66 @@
+#ifndef INTERCEPTION_CAPTURE_H
+#define INTERCEPTION_CAPTURE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Capture files, in host byte order, hold a header, the YAML description of
+// the captured device padded with NULs to a multiple of 8 bytes, the events
+// and, once the capture is finished, an index with an entry per frame, sorted
+// by time as events need not arrive in time order. A capture cut short has no
+// index, which is then rebuilt from the events.
+#define CAPTURE_MAGIC "EVDEVCAP"
+#define CAPTURE_VERSION 1
+
+struct capture_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t description_size;
+    uint64_t event_count;
+    uint64_t index_offset;
+    uint64_t frame_count;
+};
+
+struct capture_event {
+    int64_t time;  // microseconds
+    uint16_t type;
+    uint16_t code;
+    int32_t value;
+};
+
+// frame ending with a SYN_REPORT at the given time, whose first event has the
+// given position among the events
+struct capture_frame {
+    int64_t time;
+    uint64_t first;
+};
+
+int capture_write_header(int fd, const char *description);
+int capture_write_index(int fd, uint64_t event_count,
+                        const struct capture_frame *frames,
+                        uint64_t frame_count);
+
+struct capture {
+    void *map;
+    size_t size;
+    const char *description;
+    const struct capture_event *events;
+    uint64_t event_count;
+    const struct capture_frame *frames;
+    uint64_t frame_count;
+    struct capture_frame *rebuilt_frames;
+};
+
+int capture_open(struct capture *capture, const char *path);
+void capture_close(struct capture *capture);
+uint64_t capture_find_frame(const struct capture *capture, int64_t time);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,330 @@
+#include <string>
+#include <vector>
+#include <algorithm>
+
+extern "C" {
+#include <sys/ioctl.h>
+}
+
+#include "names.h"
+#include "device.hpp"
+
+static bool is_int(const std::string &s) {
+    return s.find_first_not_of("0123456789") == std::string::npos;
+}
+
+using block_type = unsigned long;
+
+static constexpr int block_size = sizeof(block_type) * 8;
+
+static constexpr int blocks_needed(int n_bits) {
+    return (n_bits - 1) / block_size + 1;
+}
+
+static bool bit(const block_type buffer[], int bit_index) {
+    return buffer[bit_index / block_size] &
+           (block_type{1} << (bit_index % block_size));
+}
+
+std::string yaml_create_from_evdev(libevdev *dev) {
+    using std::map;
+    using std::vector;
+    using std::string;
+    using std::any_of;
+
+    YAML::Emitter yaml;
+    yaml << YAML::BeginMap;
+
+    if (auto name = libevdev_get_name(dev))
+        yaml << YAML::Key << "NAME" << YAML::Value << name;
+    if (auto location = libevdev_get_phys(dev))
+        yaml << YAML::Key << "LOCATION" << YAML::Value << location;
+    if (auto id = libevdev_get_uniq(dev))
+        yaml << YAML::Key << "ID" << YAML::Value << id;
+    if (auto product = libevdev_get_id_product(dev))
+        yaml << YAML::Key << "PRODUCT" << YAML::Value << product;
+    if (auto vendor = libevdev_get_id_vendor(dev))
+        yaml << YAML::Key << "VENDOR" << YAML::Value << vendor;
+    if (auto bustype = libevdev_get_id_bustype(dev)) {
+        if (auto bus_name = bus_get_name(bustype))
+            yaml << YAML::Key << "BUSTYPE" << YAML::Value << bus_name;
+        else
+            yaml << YAML::Key << "BUSTYPE" << YAML::Value << bustype;
+    }
+    if (auto driver_version = libevdev_get_driver_version(dev))
+        yaml << YAML::Key << "DRIVER_VERSION" << YAML::Value << driver_version;
+
+    vector<string> properties;
+
+    if (libevdev_has_property(dev, INPUT_PROP_POINTER))
+        properties.push_back("INPUT_PROP_POINTER");
+    if (libevdev_has_property(dev, INPUT_PROP_DIRECT))
+        properties.push_back("INPUT_PROP_DIRECT");
+    if (libevdev_has_property(dev, INPUT_PROP_BUTTONPAD))
+        properties.push_back("INPUT_PROP_BUTTONPAD");
+    if (libevdev_has_property(dev, INPUT_PROP_SEMI_MT))
+        properties.push_back("INPUT_PROP_SEMI_MT");
+    if (libevdev_has_property(dev, INPUT_PROP_TOPBUTTONPAD))
+        properties.push_back("INPUT_PROP_TOPBUTTONPAD");
+    if (libevdev_has_property(dev, INPUT_PROP_POINTING_STICK))
+        properties.push_back("INPUT_PROP_POINTING_STICK");
+    if (libevdev_has_property(dev, INPUT_PROP_ACCELEROMETER))
+        properties.push_back("INPUT_PROP_ACCELEROMETER");
+
+    if (!properties.empty())
+        yaml << YAML::Key << "PROPERTIES" << YAML::Value << properties;
+
+    int fd = libevdev_get_fd(dev);
+
+    block_type type_mask[blocks_needed(EV_MAX)]   = {};
+    block_type event_mask[blocks_needed(KEY_MAX)] = {};
+    if (ioctl(fd, EVIOCGBIT(0, EV_MAX), type_mask) != -1 &&
+        any_of(type_mask, type_mask + blocks_needed(EV_MAX),
+               [](block_type block) { return block != block_type{}; })) {
+        yaml << YAML::Key << "EVENTS" << YAML::Value;
+        yaml << YAML::BeginMap;
+        for (int type_code = 0; type_code <= EV_MAX; ++type_code) {
+            if (!bit(type_mask, type_code))
+                continue;
+            int event_max         = libevdev_event_type_get_max(type_code);
+            const char *type_name = libevdev_event_type_get_name(type_code);
+            yaml << YAML::Key;
+            if (type_name)
+                yaml << libevdev_event_type_get_name(type_code);
+            else
+                yaml << type_code;
+            yaml << YAML::Value;
+            switch (type_code) {
+                case EV_SYN:
+                    yaml << YAML::Flow << YAML::BeginSeq;
+                    if (libevdev_has_event_code(dev, EV_SYN, SYN_REPORT))
+                        yaml << "SYN_REPORT";
+                    if (libevdev_has_event_code(dev, EV_SYN, SYN_CONFIG))
+                        yaml << "SYN_CONFIG";
+                    if (libevdev_has_event_code(dev, EV_SYN, SYN_MT_REPORT))
+                        yaml << "SYN_MT_REPORT";
+                    if (libevdev_has_event_code(dev, EV_SYN, SYN_DROPPED))
+                        yaml << "SYN_DROPPED";
+                    yaml << YAML::EndSeq;
+                    break;
+                case EV_REP: {
+                    int delay, period;
+                    libevdev_get_repeat(dev, &delay, &period);
+                    yaml << YAML::BeginMap;
+                    yaml << YAML::Key << "REP_DELAY" << YAML::Value << delay;
+                    yaml << YAML::Key << "REP_PERIOD" << YAML::Value << period;
+                    yaml << YAML::EndMap;
+                } break;
+                case EV_ABS:
+                    if (ioctl(fd, EVIOCGBIT(type_code, event_max),
+                              event_mask) != -1) {
+                        yaml << YAML::BeginMap;
+                        for (int event_code = 0; event_code <= event_max;
+                             ++event_code) {
+                            if (!bit(event_mask, event_code))
+                                continue;
+                            if (auto absinfo =
+                                    libevdev_get_abs_info(dev, event_code)) {
+                                if (auto event_name =
+                                        libevdev_event_code_get_name(
+                                            type_code, event_code))
+                                    yaml << YAML::Key << event_name
+                                         << YAML::Value;
+                                else
+                                    yaml << YAML::Key << event_code
+                                         << YAML::Value;
+                                yaml << YAML::BeginMap;
+                                yaml << YAML::Key << "VALUE" << YAML::Value
+                                     << absinfo->value;
+                                yaml << YAML::Key << "MIN" << YAML::Value
+                                     << absinfo->minimum;
+                                yaml << YAML::Key << "MAX" << YAML::Value
+                                     << absinfo->maximum;
+                                if (absinfo->flat > 0)
+                                    yaml << YAML::Key << "FLAT" << YAML::Value
+                                         << absinfo->flat;
+                                if (absinfo->fuzz > 0)
+                                    yaml << YAML::Key << "FUZZ" << YAML::Value
+                                         << absinfo->fuzz;
+                                if (absinfo->resolution > 0)
+                                    yaml << YAML::Key << "RES" << YAML::Value
+                                         << absinfo->resolution;
+                                yaml << YAML::EndMap;
+                            }
+                        }
+                        yaml << YAML::EndMap;
+                    }
+                    break;
+                default:
+                    if (ioctl(fd, EVIOCGBIT(type_code, event_max),
+                              event_mask) != -1) {
+                        yaml << YAML::Flow << YAML::BeginSeq;
+                        for (int event_code = 0; event_code <= event_max;
+                             ++event_code) {
+                            if (!bit(event_mask, event_code))
+                                continue;
+                            if (auto event_name = libevdev_event_code_get_name(
+                                    type_code, event_code))
+                                yaml << event_name;
+                            else
+                                yaml << event_code;
+                        }
+                        yaml << YAML::EndSeq;
+                    }
+                    break;
+            }
+        }
+        yaml << YAML::EndMap;
+    }
+
+    yaml << YAML::EndMap;
+    return yaml.c_str();
+}
+
+void evdev_merge_from_yaml(libevdev *dev, const YAML::Node &config) {
+    using std::stoi;
+    using std::string;
+
+    if (auto name = config["NAME"])
+        libevdev_set_name(dev, name.as<string>().c_str());
+    if (auto id = config["ID"])
+        libevdev_set_uniq(dev, id.as<string>().c_str());
+    if (auto product = config["PRODUCT"])
+        libevdev_set_id_product(dev, product.as<int>());
+    if (auto vendor = config["VENDOR"])
+        libevdev_set_id_vendor(dev, vendor.as<int>());
+    if (auto bustype = config["BUSTYPE"]) {
+        int bus = bus_from_name(bustype.as<string>().c_str());
+        libevdev_set_id_bustype(dev, bus < 0 ? 0 : bus);
+    }
+    if (auto version = config["VERSION"])
+        libevdev_set_id_version(dev, version.as<int>());
+    if (auto property = config["PROPERTIES"])
+        for (auto it = property.begin(); it != property.end(); ++it) {
+            auto property = property_from_name(it->as<string>().c_str());
+            if (property != -1)
+                libevdev_enable_property(dev, property);
+        }
+    if (auto event_types = config["EVENTS"]) {
+        for (const auto &event_type : event_types) {
+            auto event_type_string = event_type.first.as<string>();
+            if (event_type_string == "EV_REP") {
+                if (auto rep_delay = event_type.second["REP_DELAY"]) {
+                    auto rep_delay_value = rep_delay.as<int>();
+                    libevdev_enable_event_code(dev, EV_REP, REP_DELAY,
+                                               &rep_delay_value);
+                }
+                if (auto rep_period = event_type.second["REP_PERIOD"]) {
+                    auto rep_period_value = rep_period.as<int>();
+                    libevdev_enable_event_code(dev, EV_REP, REP_PERIOD,
+                                               &rep_period_value);
+                }
+            } else if (event_type_string == "EV_ABS") {
+                for (const auto &axis : event_type.second) {
+                    input_absinfo absinfo = {};
+                    if (auto axis_value = axis.second["VALUE"])
+                        absinfo.value = axis_value.as<int>();
+                    if (auto axis_min = axis.second["MIN"])
+                        absinfo.minimum = axis_min.as<int>();
+                    if (auto axis_max = axis.second["MAX"])
+                        absinfo.maximum = axis_max.as<int>();
+                    if (auto axis_flat = axis.second["FLAT"])
+                        absinfo.flat = axis_flat.as<int>();
+                    if (auto fuzz = axis.second["FUZZ"])
+                        absinfo.fuzz = fuzz.as<int>();
+                    if (auto res = axis.second["RES"])
+                        absinfo.resolution = res.as<int>();
+
+                    if (!axis.second["VALUE"] && axis.second["MAX"])
+                        absinfo.value = absinfo.maximum;
+                    if (!axis.second["VALUE"] && axis.second["MIN"])
+                        absinfo.value = absinfo.minimum;
+
+                    auto axis_code = event_code_from_name(
+                        EV_ABS, axis.first.as<string>().c_str());
+                    if (axis_code != -1)
+                        libevdev_enable_event_code(dev, EV_ABS, axis_code,
+                                                   &absinfo);
+                }
+            } else {
+                auto event_type_code =
+                    event_type_from_name(event_type_string.c_str());
+
+                for (const auto &event : event_type.second) {
+                    auto event_string = event.as<string>();
+                    if (is_int(event_string))
+                        libevdev_enable_event_code(dev, event_type_code,
+                                                   stoi(event_string), nullptr);
+                    else {
+                        auto event_code = event_code_from_name(
+                            event_type_code, event_string.c_str());
+                        if (event_code != -1)
+                            libevdev_enable_event_code(dev, event_type_code,
+                                                       event_code, nullptr);
+                    }
+                }
+            }
+        }
+    }
+}
+
+// Same result as merging the YAML description yaml_create_from_evdev gives
+// of reference, without going through YAML: identifiers only when set, the
+// properties and bus types YAML knows by name, and capabilities as reported,
+// with the non-positive absinfo fields YAML leaves out cleared.
+void evdev_merge_from_evdev(libevdev *dev, const libevdev *reference) {
+    static const int properties[] = {
+        INPUT_PROP_POINTER,      INPUT_PROP_DIRECT,
+        INPUT_PROP_BUTTONPAD,    INPUT_PROP_SEMI_MT,
+        INPUT_PROP_TOPBUTTONPAD, INPUT_PROP_POINTING_STICK,
+        INPUT_PROP_ACCELEROMETER};
+
+    if (auto name = libevdev_get_name(reference))
+        libevdev_set_name(dev, name);
+    if (auto id = libevdev_get_uniq(reference))
+        libevdev_set_uniq(dev, id);
+    if (auto product = libevdev_get_id_product(reference))
+        libevdev_set_id_product(dev, product);
+    if (auto vendor = libevdev_get_id_vendor(reference))
+        libevdev_set_id_vendor(dev, vendor);
+    if (auto bustype = libevdev_get_id_bustype(reference))
+        libevdev_set_id_bustype(dev, bus_get_name(bustype) ? bustype : 0);
+
+    for (int property : properties)
+        if (libevdev_has_property(reference, property))
+            libevdev_enable_property(dev, property);
+
+    for (int type = 0; type <= EV_MAX; ++type) {
+        if (!libevdev_has_event_type(reference, type) ||
+            !libevdev_event_type_get_name(type))
+            continue;
+
+        switch (type) {
+            case EV_REP: {
+                int delay = 0, period = 0;
+                libevdev_get_repeat(reference, &delay, &period);
+                libevdev_enable_event_code(dev, EV_REP, REP_DELAY, &delay);
+                libevdev_enable_event_code(dev, EV_REP, REP_PERIOD, &period);
+            } break;
+            case EV_ABS:
+                for (int code = 0; code <= ABS_MAX; ++code) {
+                    auto absinfo = libevdev_get_abs_info(reference, code);
+                    if (!absinfo || !libevdev_event_code_get_name(EV_ABS, code))
+                        continue;
+                    input_absinfo copy = *absinfo;
+                    copy.flat          = copy.flat > 0 ? copy.flat : 0;
+                    copy.fuzz          = copy.fuzz > 0 ? copy.fuzz : 0;
+                    copy.resolution = copy.resolution > 0 ? copy.resolution : 0;
+                    libevdev_enable_event_code(dev, EV_ABS, code, &copy);
+                }
+                break;
+            default: {
+                int max = type == EV_SYN ? SYN_DROPPED
+                                         : libevdev_event_type_get_max(type);
+                for (int code = 0; code <= max; ++code)
+                    if (libevdev_has_event_code(reference, type, code))
+                        libevdev_enable_event_code(dev, type, code, nullptr);
+            } break;
+        }
+    }
+}
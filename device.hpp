@@ -0,0 +1,16 @@
+#ifndef INTERCEPTION_DEVICE_HPP
+#define INTERCEPTION_DEVICE_HPP
+
+#include <string>
+
+#include <yaml-cpp/yaml.h>
+#include <libevdev/libevdev.h>
+
+// YAML device descriptions, as printed by `uinput -p` and stored in the
+// header of capture files, and their merge into a libevdev device being
+// built, either from YAML or straight from a reference device.
+std::string yaml_create_from_evdev(libevdev *dev);
+void evdev_merge_from_yaml(libevdev *dev, const YAML::Node &config);
+void evdev_merge_from_evdev(libevdev *dev, const libevdev *reference);
+
+#endif
@@ -0,0 +1,445 @@
+#include <cerrno>
+#include <cstdio>
+#include <thread>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <functional>
+
+extern "C" {
+#include <poll.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+}
+
+#include "graph.hpp"
+
+namespace {
+
+// events waiting for a command to read them, past which new frames are
+// dropped instead
+constexpr size_t max_backlog = 1000 * event_queue::max_frame;
+
+// how often threads blocked on queues or commands check for the graph going
+// away
+constexpr int stop_check_ms = 100;
+
+bool is_frame_end(const input_event &event) {
+    return event.type == EV_SYN && event.code == SYN_REPORT;
+}
+
+std::runtime_error system_error(const std::string &what) {
+    return std::runtime_error(what + ": " + std::strerror(errno));
+}
+
+}  // namespace
+
+event_graph::event_graph(const YAML::Node &config) {
+    using std::string;
+    using std::vector;
+    using std::invalid_argument;
+
+    vector<string> shell = {"sh", "-c"};
+    if (auto node = config["SHELL"])
+        shell = node.as<vector<string>>();
+
+    for (const auto &field : config) {
+        auto key = field.first.as<string>();
+        if (key != "SHELL" && key != "QUEUES" && key != "ROUTES")
+            throw invalid_argument("unknown field in graph: " + key);
+    }
+
+    for (const auto &route_node : config["ROUTES"]) {
+        for (const auto &field : route_node) {
+            auto key = field.first.as<string>();
+            if (key != "IN" && key != "OUT" && key != "SWITCH" && key != "CMD")
+                throw invalid_argument("unknown field in route: " + key);
+        }
+
+        if (auto cmd_node = route_node["CMD"]) {
+            if (route_node["SWITCH"])
+                throw invalid_argument("a CMD route can't have a SWITCH");
+            commands.emplace_back(new command());
+            auto &command = *commands.back();
+            command.argv  = shell;
+            command.argv.push_back(cmd_node.as<string>());
+            command.outputs = route(route_node["OUT"]);
+            if (auto in = route_node["IN"]) {
+                command.input = &nodes[in.as<string>()];
+                command.input->commands.push_back(&command);
+            }
+            continue;
+        }
+
+        if (!route_node["IN"])
+            throw invalid_argument("missing IN field in route");
+        auto &in = nodes[route_node["IN"].as<string>()];
+        if (!route_node["SWITCH"]) {
+            auto outputs = route(route_node["OUT"]);
+            in.outputs.insert(in.outputs.end(), outputs.begin(),
+                              outputs.end());
+            continue;
+        }
+
+        switches.emplace_back(new switch_route());
+        auto &switch_route = *switches.back();
+        switch_route.outputs.push_back(route(route_node["OUT"]));
+        for (const auto &selector : route_node["SWITCH"]) {
+            nodes[selector.first.as<string>()].selections.emplace_back(
+                &switch_route, switch_route.outputs.size());
+            switch_route.outputs.push_back(route(selector.second));
+        }
+        in.switches.push_back(&switch_route);
+    }
+
+    check_cycles();
+
+    for (const auto &queue_node : config["QUEUES"]) {
+        if (!queue_node.IsMap()) {
+            create_queue(queue_node.as<string>(), YAML::Node());
+            continue;
+        }
+        for (const auto &queue : queue_node)
+            create_queue(queue.first.as<string>(), queue.second);
+    }
+}
+
+// Creates a queue from options like those of mux -c, all optional:
+//
+//     M: {TYPE: ring, SIZE: 200, POLICY: "coalesce:50", STARVATION: 4}
+void event_graph::create_queue(const std::string &name,
+                               const YAML::Node &options) {
+    using std::string;
+    using std::invalid_argument;
+
+    for (const auto &field : options) {
+        auto key = field.first.as<string>();
+        if (key != "TYPE" && key != "SIZE" && key != "POLICY" &&
+            key != "STARVATION")
+            throw invalid_argument("unknown field in queue " + name + ": " +
+                                   key);
+    }
+
+    auto type            = event_queue::ring;
+    auto policy          = event_queue::fail;
+    unsigned int timeout = 0;
+    if (auto node = options["TYPE"])
+        if (!event_queue::parse_type(node.as<string>(), type))
+            throw invalid_argument("unknown type for queue " + name);
+    if (auto node = options["POLICY"])
+        if (!event_queue::parse_policy(node.as<string>(), policy, timeout))
+            throw invalid_argument("unknown policy for queue " + name);
+    size_t size = options["SIZE"] ? options["SIZE"].as<size_t>() : 100;
+    unsigned int starvation =
+        options["STARVATION"] ? options["STARVATION"].as<unsigned int>() : 0;
+
+    event_queue::create(name, type, size, policy, timeout, starvation);
+    queues.push_back(event_queue::open(name));
+    queue_nodes.push_back(&nodes[name]);
+}
+
+event_graph::~event_graph() {
+    stopping = true;
+    if (receiver.joinable())
+        receiver.join();
+
+    for (auto &command : commands) {
+        {
+            std::lock_guard<std::mutex> lock(command->mutex);
+            command->closed = true;
+            command->backlog.clear();
+        }
+        finish(*command);
+        if (command->in >= 0)
+            close(command->in);
+        if (command->out >= 0)
+            close(command->out);
+    }
+}
+
+std::vector<event_graph::node *> event_graph::route(const YAML::Node &names) {
+    std::vector<node *> outputs;
+    if (!names)
+        return outputs;
+    if (!names.IsSequence())
+        return {&nodes[names.as<std::string>()]};
+    for (const auto &name : names)
+        outputs.push_back(&nodes[name.as<std::string>()]);
+    return outputs;
+}
+
+// Frames are routed between streams by recursion, which a cycle would never
+// get out of, and through commands, which a cycle would feed back forever.
+void event_graph::check_cycles() {
+    enum { unvisited, visiting, visited };
+    std::map<const node *, int> state;
+
+    std::function<void(const node &)> visit = [&](const node &from) {
+        int &from_state = state[&from];
+        if (from_state == visited)
+            return;
+        if (from_state == visiting)
+            throw std::invalid_argument("routes make a cycle");
+        from_state = visiting;
+        for (auto to : from.outputs)
+            visit(*to);
+        for (auto switch_route : from.switches)
+            for (const auto &outputs : switch_route->outputs)
+                for (auto to : outputs)
+                    visit(*to);
+        for (auto command : from.commands)
+            for (auto to : command->outputs)
+                visit(*to);
+        state[&from] = visited;
+    };
+
+    for (const auto &node : nodes)
+        visit(node.second);
+}
+
+void event_graph::launch(command &command) {
+    int in[2] = {-1, -1}, out[2] = {-1, -1};
+    if ((command.input && pipe2(in, O_CLOEXEC) < 0) ||
+        (!command.outputs.empty() && pipe2(out, O_CLOEXEC) < 0))
+        throw system_error("error creating pipe for \"" + command.argv.back() +
+                           '"');
+
+    pid_t pid = fork();
+    if (pid < 0)
+        throw system_error("fork failed for \"" + command.argv.back() + '"');
+    if (pid == 0) {
+        if ((in[0] >= 0 && dup2(in[0], STDIN_FILENO) < 0) ||
+            (out[1] >= 0 && dup2(out[1], STDOUT_FILENO) < 0))
+            std::perror("error redirecting command"), std::_Exit(EXIT_FAILURE);
+        std::vector<char *> argv;
+        for (auto &arg : command.argv)
+            argv.push_back(const_cast<char *>(arg.c_str()));
+        argv.push_back(nullptr);
+        // ignoring SIGPIPE is only for mux, and it would outlive exec
+        signal(SIGPIPE, SIG_DFL);
+        execvp(argv[0], argv.data());
+        std::perror(("exec failed for \"" + command.argv.back() + '"').c_str());
+        std::_Exit(EXIT_FAILURE);
+    }
+
+    if (in[0] >= 0)
+        close(in[0]);
+    // so that the feeder can give up on a command that isn't reading
+    if (in[1] >= 0 && fcntl(in[1], F_SETFL, O_NONBLOCK) < 0)
+        throw system_error("error setting up pipe for \"" +
+                           command.argv.back() + '"');
+    if (out[1] >= 0)
+        close(out[1]);
+    command.in  = in[1];
+    command.out = out[0];
+    command.pid = pid;
+}
+
+void event_graph::dispatch(node &node, const input_event *events,
+                           size_t count) {
+    for (const auto &selection : node.selections)
+        selection.first->current = selection.second;
+
+    for (auto output : node.outputs)
+        dispatch(*output, events, count);
+
+    // the route is taken once per frame, so that a switch never splits one
+    for (auto switch_route : node.switches)
+        for (auto output : switch_route->outputs[switch_route->current])
+            dispatch(*output, events, count);
+
+    for (auto command : node.commands) {
+        std::lock_guard<std::mutex> lock(command->mutex);
+        if (command->closed)
+            continue;
+        if (command->backlog.size() + count > max_backlog) {
+            if (!command->overflowing)
+                std::fprintf(stderr, "\"%s\" is falling behind, dropping "
+                                     "frames\n",
+                             command->argv.back().c_str());
+            command->overflowing = true;
+            continue;
+        }
+        command->overflowing = false;
+        command->backlog.insert(command->backlog.end(), events, events + count);
+        command->routed.notify_one();
+    }
+}
+
+// Writes the frames routed to a command as they come, until no more are
+// coming or the command stops reading, when it's dropped from the routes, or
+// the graph goes away.
+void event_graph::feed(command &command) {
+    std::vector<input_event> frames;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(command.mutex);
+            command.routed.wait(lock, [&]() {
+                return !command.backlog.empty() || command.done;
+            });
+            if (command.backlog.empty())
+                break;
+            frames.swap(command.backlog);
+        }
+
+        auto data   = reinterpret_cast<const char *>(frames.data());
+        size_t size = frames.size() * sizeof frames[0];
+        while (size) {
+            ssize_t written = write(command.in, data, size);
+            if (written < 0 && errno == EINTR)
+                continue;
+            if (written < 0 && errno == EAGAIN) {
+                pollfd fd = {command.in, POLLOUT, 0};
+                if (poll(&fd, 1, stop_check_ms) < 0 && errno != EINTR)
+                    throw system_error("error polling \"" +
+                                       command.argv.back() + '"');
+                std::lock_guard<std::mutex> lock(command.mutex);
+                if (command.closed)
+                    break;
+                continue;
+            }
+            if (written < 0 && errno == EPIPE) {
+                std::fprintf(stderr, "\"%s\" stopped reading, dropping it\n",
+                             command.argv.back().c_str());
+                std::lock_guard<std::mutex> lock(command.mutex);
+                command.closed = true;
+                command.backlog.clear();
+                break;
+            }
+            if (written < 0)
+                throw system_error("error writing to \"" +
+                                   command.argv.back() + '"');
+            data += written;
+            size -= written;
+        }
+        frames.clear();
+        if (command.closed)
+            break;
+    }
+
+    close(command.in);
+    command.in = -1;
+}
+
+// Lets the command's feeder write what's left and waits for it.
+void event_graph::finish(command &command) {
+    {
+        std::lock_guard<std::mutex> lock(command.mutex);
+        command.done = true;
+        command.routed.notify_one();
+    }
+    if (command.feeder.joinable())
+        command.feeder.join();
+}
+
+// Routes the frames the command wrote so far, or what's left of them at
+// its end.
+void event_graph::read_output(command &command, bool eof) {
+    size_t count = command.bytes / sizeof *command.frame, start = 0;
+    for (size_t i = 0; i < count; ++i) {
+        size_t length = i + 1 - start;
+        if (!is_frame_end(command.frame[i]) &&
+            length < event_queue::max_frame && !(eof && i + 1 == count))
+            continue;
+        for (auto output : command.outputs)
+            dispatch(*output, &command.frame[start], length);
+        start = i + 1;
+    }
+
+    command.bytes -= start * sizeof *command.frame;
+    std::memmove(command.frame, &command.frame[start], command.bytes);
+}
+
+void event_graph::run() {
+    signal(SIGPIPE, SIG_IGN);
+
+    for (auto &command : commands) {
+        launch(*command);
+        if (command->in >= 0)
+            command->feeder = std::thread([this, &command]() {
+                try {
+                    feed(*command);
+                } catch (const std::exception &e) {
+                    std::fprintf(stderr,
+                                 R"(an exception occurred: "%s")"
+                                 "\n",
+                                 e.what());
+                    std::exit(EXIT_FAILURE);
+                }
+            });
+    }
+
+    if (!queues.empty())
+        receiver = std::thread([this]() {
+            try {
+                input_event frame[event_queue::max_frame];
+                size_t count, next = 0;
+                while (!stopping) {
+                    size_t id = event_queue::receive_any(
+                        queues, frame, count, next, stop_check_ms);
+                    if (id < queues.size())
+                        dispatch(*queue_nodes[id], frame, count);
+                }
+            } catch (const std::exception &e) {
+                std::fprintf(stderr,
+                             R"(an exception occurred: "%s")"
+                             "\n",
+                             e.what());
+                std::exit(EXIT_FAILURE);
+            }
+        });
+
+    std::vector<pollfd> fds;
+    std::vector<command *> writers;
+    for (auto &command : commands)
+        if (command->out >= 0) {
+            fds.push_back({command->out, POLLIN, 0});
+            writers.push_back(command.get());
+        }
+
+    while (!fds.empty() || !queues.empty()) {
+        if (poll(fds.data(), fds.size(), -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            throw system_error("error polling commands");
+        }
+
+        for (size_t i = 0; i < fds.size();) {
+            auto &command = *writers[i];
+            if (!fds[i].revents) {
+                ++i;
+                continue;
+            }
+
+            ssize_t bytes =
+                read(command.out,
+                     reinterpret_cast<char *>(command.frame) + command.bytes,
+                     sizeof command.frame - command.bytes);
+            if (bytes < 0 && errno == EINTR) {
+                ++i;
+                continue;
+            }
+            if (bytes < 0)
+                throw system_error("error reading from \"" +
+                                   command.argv.back() + '"');
+            command.bytes += bytes;
+            read_output(command, bytes == 0);
+            if (bytes) {
+                ++i;
+                continue;
+            }
+
+            close(command.out);
+            command.out = -1;
+            fds.erase(fds.begin() + i);
+            writers.erase(writers.begin() + i);
+        }
+    }
+
+    for (auto &command : commands)
+        finish(*command);
+    for (auto &command : commands)
+        waitpid(command->pid, nullptr, 0);
+}
@@ -0,0 +1,118 @@
+#ifndef INTERCEPTION_GRAPH_HPP
+#define INTERCEPTION_GRAPH_HPP
+
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstddef>
+#include <utility>
+#include <condition_variable>
+
+#include <sys/types.h>
+#include <linux/input.h>
+
+#include <yaml-cpp/yaml.h>
+
+#include "queue.hpp"
+
+// A routing graph of named streams of input events, run in a single process
+// in place of a pipeline of muxes. A stream hands each frame it gets over to
+// the streams it's routed to, to the ones its switches currently point at,
+// and to the commands reading from it, whose output goes back into streams.
+// Frames move between streams by pointer, only getting copied across the
+// boundaries of the graph: the queues other processes write to, and the pipes
+// of the commands it runs.
+class event_graph {
+    struct node;
+
+    struct switch_route {
+        std::atomic<size_t> current{0};
+        // the default route first, then one per selector
+        std::vector<std::vector<node *>> outputs;
+    };
+
+    struct command {
+        std::vector<std::string> argv;
+        node *input = nullptr;
+        std::vector<node *> outputs;
+        int in = -1, out = -1;
+        pid_t pid = -1;
+        // output read so far that doesn't make a frame yet
+        input_event frame[event_queue::max_frame];
+        size_t bytes = 0;
+        // frames routed to the command and not written yet, which a thread
+        // of its own writes, so that a command that isn't reading holds
+        // nothing else up; closed once the command stops reading or the
+        // graph goes away, done once no more frames are coming, overflowing
+        // while frames are dropped for the backlog being full
+        std::mutex mutex;
+        std::condition_variable routed;
+        std::vector<input_event> backlog;
+        bool closed = false, done = false, overflowing = false;
+        std::thread feeder;
+    };
+
+    struct node {
+        std::vector<node *> outputs;
+        std::vector<switch_route *> switches;
+        std::vector<std::pair<switch_route *, size_t>> selections;
+        std::vector<command *> commands;
+    };
+
+    std::map<std::string, node> nodes;
+    std::vector<std::unique_ptr<switch_route>> switches;
+    std::vector<std::unique_ptr<command>> commands;
+    std::vector<std::unique_ptr<event_queue>> queues;
+    std::vector<node *> queue_nodes;
+    std::thread receiver;
+    std::atomic<bool> stopping{false};
+
+    std::vector<node *> route(const YAML::Node &names);
+    void create_queue(const std::string &name, const YAML::Node &options);
+    void check_cycles();
+    void launch(command &command);
+    void feed(command &command);
+    void finish(command &command);
+    void dispatch(node &node, const input_event *events, size_t count);
+    void read_output(command &command, bool eof);
+
+public:
+    // Loads a graph like:
+    //
+    //     QUEUES: [K, X, M]
+    //     ROUTES:
+    //       - IN: K
+    //         OUT: KM
+    //       - IN: X
+    //         OUT: XM
+    //       - IN: M
+    //         OUT: KM
+    //         SWITCH: {K: KM, X: XM}
+    //       - IN: KM
+    //         CMD: caps2esc
+    //         OUT: H
+    //       - IN: XM
+    //         CMD: caps2esc -m 2
+    //         OUT: H
+    //       - IN: H
+    //         CMD: uinput -c /etc/interception/hybrid.yaml
+    //
+    // creating QUEUES for other processes to write to, as rings of 100 frames
+    // unless given options like those of mux -c:
+    //
+    //     QUEUES:
+    //       - K
+    //       - M: {SIZE: 200, POLICY: "coalesce:50", STARVATION: 4}
+    explicit event_graph(const YAML::Node &config);
+    ~event_graph();
+
+    // Launches the commands and routes frames until all of them are done
+    // writing, or forever when there are queues to read from.
+    void run();
+};
+
+#endif
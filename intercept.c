@@ -1,29 +1,752 @@
+#include <time.h>
 #include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
+#include <glob.h>
+#include <poll.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/timerfd.h>
 
 #include <libevdev/libevdev.h>
 
+#include "names.h"
+#include "stream.h"
+#include "realtime.h"
+#ifdef HAVE_LINUX_IO_URING_H
+#include "uring.h"
+#endif
+
 void print_usage(FILE *stream, const char *program) {
     fprintf(stream,
             "intercept - redirect device input events to stdout\n"
             "\n"
-            "usage: %s [-h | [-g] devnode]\n"
+            "usage: %s [-h | [-gmbTuU] [-t type] [-e event] [-r rate]\n"
+            "                 [-l usec] [--rt[=spec]] devnode...]\n"
             "\n"
             "options:\n"
             "    -h        show this message and exit\n"
-            "    -g        grab device\n"
-            "    devnode   path of device to capture events from\n",
+            "    -g        grab devices\n"
+            "    -m        timestamp events with the monotonic clock\n"
+            "    -b        batch events, writing whole frames at once\n"
+            "    -T        prefix events with the index of their device\n"
+            "    -u        read and write through io_uring (implies -b)\n"
+            "    -U        same as -u, with kernel side submission polling\n"
+            "    -t type   capture only events of the given type (repeatable)\n"
+            "    -e event  capture only the given TYPE:CODE (repeatable)\n"
+            "    -r rate   coalesce relative motion to at most rate frames/s\n"
+            "    -l usec   hold coalesced relative motion back at most usec\n"
+            "    --rt[=spec]\n"
+            "              run realtime with locked memory, spec being\n"
+            "              [fifo|rr][:prio][@cpulist] (default: fifo:10)\n"
+            "    devnode   path or glob of devices to capture events from\n"
+            "              (more than one implies -b)\n",
             program);
 }
 
+#define LONG_BITS (sizeof(unsigned long) * 8)
+#define NLONGS(bits) (((bits)-1) / LONG_BITS + 1)
+
+// Events selected with -t and -e, installed on the devices with EVIOCSMASK so
+// that the kernel doesn't even wake us up for the rest. EV_SYN always passes.
+struct event_mask {
+    int enabled;
+    int whole_type[EV_CNT];
+    unsigned long types[NLONGS(EV_CNT)];
+    unsigned long codes[EV_CNT][NLONGS(KEY_CNT)];
+};
+
+void set_bit(unsigned long bits[], int bit) {
+    bits[bit / LONG_BITS] |= 1UL << (bit % LONG_BITS);
+}
+
+int is_int(const char *s) { return s[strspn(s, "0123456789")] == '\0'; }
+
+long parse_positive(const char *s) {
+    char *end;
+    long value = strtol(s, &end, 10);
+    return *s && !*end && value > 0 ? value : -1;
+}
+
+int parse_type(const char *name) {
+    if (!*name)
+        return -1;
+    int type = is_int(name) ? atoi(name) : event_type_from_name(name);
+    return type < EV_CNT ? type : -1;
+}
+
+int parse_code(int type, const char *name) {
+    if (!*name)
+        return -1;
+    int code = is_int(name) ? atoi(name) : event_code_from_name(type, name);
+    return code < KEY_CNT ? code : -1;
+}
+
+int add_type(struct event_mask *mask, const char *name) {
+    int type = parse_type(name);
+    if (type < 0)
+        return -1;
+
+    mask->enabled          = 1;
+    mask->whole_type[type] = 1;
+    set_bit(mask->types, type);
+
+    return 0;
+}
+
+int add_event(struct event_mask *mask, const char *event) {
+    char type_name[64];
+    const char *colon = strchr(event, ':');
+    if (!colon || (size_t)(colon - event) >= sizeof type_name)
+        return -1;
+    memcpy(type_name, event, colon - event);
+    type_name[colon - event] = '\0';
+
+    int type = parse_type(type_name);
+    if (type < 0)
+        return -1;
+    int code = parse_code(type, colon + 1);
+    if (code < 0)
+        return -1;
+
+    mask->enabled = 1;
+    set_bit(mask->types, type);
+    set_bit(mask->codes[type], code);
+
+    return 0;
+}
+
+int install_mask(int fd, const struct event_mask *mask) {
+    struct input_mask types = {.type       = 0,
+                               .codes_size = sizeof mask->types,
+                               .codes_ptr  = (uintptr_t)mask->types};
+    if (ioctl(fd, EVIOCSMASK, &types) < 0)
+        return -1;
+
+    for (int type = 1; type < EV_CNT; ++type) {
+        if (mask->whole_type[type] ||
+            !(mask->types[type / LONG_BITS] & 1UL << (type % LONG_BITS)))
+            continue;
+
+        struct input_mask codes = {.type       = type,
+                                   .codes_size = sizeof mask->codes[type],
+                                   .codes_ptr  = (uintptr_t)mask->codes[type]};
+        if (ioctl(fd, EVIOCSMASK, &codes) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+#define FRAME_SIZE 256
+#define OUTPUT_SIZE 65536
+#define READ_SIZE 64
+
+// Relative motion of consecutive pure EV_REL frames summed up while waiting
+// to be written out as a single frame.
+struct motion {
+    int pending;
+    int64_t deadline; // when pending motion must be written out
+    int64_t last;     // when motion was last written out
+    struct timeval time;
+    int values[REL_CNT];
+};
+
+struct device {
+    int fd;
+    uint32_t tag;
+    struct libevdev *dev;
+    struct motion motion;
+    size_t size; // events of the frame being gathered
+    struct input_event frame[FRAME_SIZE];
+
+    // io_uring backend's state of the read in flight
+    int reading, completed, result;
+    struct input_event buffer[READ_SIZE];
+};
+
+struct output {
+    int tagged;
+    int64_t motion_period;  // minimum interval between motion frames
+    int64_t motion_latency; // maximum time motion may be held back
+    size_t size;
+    char data[OUTPUT_SIZE];
+};
+
+int64_t now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * INT64_C(1000000000) + ts.tv_nsec;
+}
+
+int write_all(int fd, const void *data, size_t size) {
+    for (const char *p = data; size > 0;) {
+        ssize_t written = write(fd, p, size);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        p += written;
+        size -= written;
+    }
+
+    return 0;
+}
+
+int flush_output(struct output *output) {
+    if (write_all(STDOUT_FILENO, output->data, output->size) < 0)
+        return -1;
+
+    output->size = 0;
+
+    return 0;
+}
+
+int emit_events(struct output *output, uint32_t tag,
+                const struct input_event *events, size_t count) {
+    size_t record_size = output->tagged ? sizeof(struct tagged_input_event)
+                                        : sizeof(struct input_event);
+
+    if (output->size + count * record_size > OUTPUT_SIZE &&
+        flush_output(output) < 0)
+        return -1;
+
+    for (size_t i = 0; i < count; ++i) {
+        if (output->tagged) {
+            struct tagged_input_event record = {.tag = tag, .event = events[i]};
+            memcpy(output->data + output->size, &record, sizeof record);
+        } else
+            memcpy(output->data + output->size, &events[i], sizeof events[i]);
+        output->size += record_size;
+    }
+
+    return 0;
+}
+
+int emit_frame(struct output *output, struct device *device) {
+    int rc = emit_events(output, device->tag, device->frame, device->size);
+    device->size = 0;
+    return rc;
+}
+
+int is_coalescing(const struct output *output) {
+    return output->motion_period || output->motion_latency;
+}
+
+int is_motion_frame(const struct device *device) {
+    for (size_t i = 0; i + 1 < device->size; ++i)
+        if (device->frame[i].type != EV_REL)
+            return 0;
+
+    return device->size > 1;
+}
+
+void merge_motion(struct output *output, struct device *device, int64_t t) {
+    struct motion *motion = &device->motion;
+
+    if (!motion->pending) {
+        motion->pending  = 1;
+        motion->deadline = INT64_MAX;
+        if (output->motion_period)
+            motion->deadline = motion->last + output->motion_period;
+        if (output->motion_latency &&
+            t + output->motion_latency < motion->deadline)
+            motion->deadline = t + output->motion_latency;
+    }
+
+    for (size_t i = 0; i + 1 < device->size; ++i)
+        if (device->frame[i].code < REL_CNT)
+            motion->values[device->frame[i].code] += device->frame[i].value;
+    motion->time = device->frame[device->size - 1].time;
+
+    device->size = 0;
+}
+
+int flush_motion(struct output *output, struct device *device, int64_t t) {
+    struct motion *motion = &device->motion;
+
+    if (!motion->pending)
+        return 0;
+
+    struct input_event events[REL_CNT + 1];
+    size_t count = 0;
+    for (int code = 0; code < REL_CNT; ++code)
+        if (motion->values[code])
+            events[count++] = (struct input_event){
+                .time  = motion->time,
+                .type  = EV_REL,
+                .code  = code,
+                .value = motion->values[code]};
+
+    memset(motion->values, 0, sizeof motion->values);
+    motion->pending = 0;
+    motion->last    = t;
+
+    if (!count)
+        return 0;
+
+    events[count++] = (struct input_event){
+        .time = motion->time, .type = EV_SYN, .code = SYN_REPORT};
+
+    return emit_events(output, device->tag, events, count);
+}
+
+// Moves complete frames of a device to the output. When coalescing, pure
+// motion frames are merged instead, and any other frame pushes the pending
+// motion out ahead of it.
+int gather_event(struct output *output, struct device *device,
+                 const struct input_event *input) {
+    device->frame[device->size++] = *input;
+    int complete = input->type == EV_SYN && input->code == SYN_REPORT;
+    if (!complete && device->size < FRAME_SIZE)
+        return 0;
+
+    if (!is_coalescing(output))
+        return emit_frame(output, device);
+
+    int64_t t = now();
+    if (complete && is_motion_frame(device)) {
+        merge_motion(output, device, t);
+        if (device->motion.deadline <= t)
+            return flush_motion(output, device, t);
+        return 0;
+    }
+
+    if (flush_motion(output, device, t) < 0)
+        return -1;
+
+    return emit_frame(output, device);
+}
+
+// Reads what a device has ready, with libevdev filling its queue from a single
+// read() on the non-blocking fd. Returns 1 once the device is gone.
+int drain_device(struct output *output, struct device *device) {
+    for (;;) {
+        struct input_event input;
+        int rc = libevdev_next_event(device->dev, LIBEVDEV_READ_FLAG_NORMAL,
+                                     &input);
+
+        if (rc == LIBEVDEV_READ_STATUS_SYNC) {
+            while (rc == LIBEVDEV_READ_STATUS_SYNC)
+                rc = libevdev_next_event(device->dev, LIBEVDEV_READ_FLAG_SYNC,
+                                         &input);
+
+            // the kernel dropped part of the frame being gathered
+            device->size = 0;
+            continue;
+        }
+
+        if (rc == -EAGAIN)
+            return 0;
+
+        if (rc != LIBEVDEV_READ_STATUS_SUCCESS)
+            return 1;
+
+        if (gather_event(output, device, &input) < 0)
+            return -1;
+    }
+}
+
+// Writes out the motion whose deadline has passed, returning the earliest
+// deadline still pending.
+int64_t flush_due_motion(struct output *output, struct device *devices,
+                         size_t count) {
+    int64_t t = now(), next = INT64_MAX;
+
+    for (size_t i = 0; i < count; ++i) {
+        struct motion *motion = &devices[i].motion;
+        if (!devices[i].dev || !motion->pending)
+            continue;
+        if (motion->deadline > t) {
+            if (motion->deadline < next)
+                next = motion->deadline;
+        } else if (flush_motion(output, &devices[i], t) < 0)
+            return -1;
+    }
+
+    return next;
+}
+
+int arm_timer(int timer, int64_t deadline) {
+    struct itimerspec spec = {0};
+    if (deadline != INT64_MAX) {
+        spec.it_value.tv_sec  = deadline / 1000000000;
+        spec.it_value.tv_nsec = deadline % 1000000000;
+    }
+
+    return timerfd_settime(timer, TFD_TIMER_ABSTIME, &spec, NULL);
+}
+
+int drop_device(struct output *output, struct device *device) {
+    int rc = flush_motion(output, device, now());
+
+    libevdev_free(device->dev);
+    close(device->fd);
+    device->dev = NULL;
+    device->fd  = -1;
+
+    return rc;
+}
+
+// Watches all devices from a single epoll loop, merging their frames into
+// stdout without ever interleaving two frames. A device that goes away is
+// dropped while the others keep being served.
+int run_multiplexed(struct device *devices, size_t count,
+                    struct output *output) {
+    int epoll = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll < 0)
+        return perror("epoll_create1 failed"), -1;
+
+    int result = -1, timer = -1;
+    int64_t armed = INT64_MAX;
+
+    if (is_coalescing(output)) {
+        timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        struct epoll_event event = {.events = EPOLLIN, .data = {.ptr = NULL}};
+        if (timer < 0 || epoll_ctl(epoll, EPOLL_CTL_ADD, timer, &event) < 0) {
+            perror("timer setup failed");
+            goto teardown_epoll;
+        }
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        struct epoll_event event = {.events = EPOLLIN,
+                                    .data   = {.ptr = &devices[i]}};
+        if (epoll_ctl(epoll, EPOLL_CTL_ADD, devices[i].fd, &event) < 0) {
+            perror("epoll_ctl failed");
+            goto teardown_epoll;
+        }
+    }
+
+    for (size_t active = count; active > 0;) {
+        struct epoll_event events[16];
+        int ready = epoll_wait(epoll, events, 16, -1);
+        if (ready < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("epoll_wait failed");
+            goto teardown_epoll;
+        }
+
+        for (int i = 0; i < ready; ++i) {
+            struct device *device = events[i].data.ptr;
+            if (!device) {
+                uint64_t expirations;
+                if (read(timer, &expirations, sizeof expirations) < 0 &&
+                    errno != EAGAIN)
+                    goto teardown_epoll;
+                continue;
+            }
+
+            int rc = drain_device(output, device);
+            if (rc < 0)
+                goto teardown_epoll;
+            if (rc == 0 && !(events[i].events & (EPOLLHUP | EPOLLERR)))
+                continue;
+
+            epoll_ctl(epoll, EPOLL_CTL_DEL, device->fd, NULL);
+            if (drop_device(output, device) < 0)
+                goto teardown_epoll;
+            --active;
+        }
+
+        if (timer >= 0) {
+            int64_t deadline = flush_due_motion(output, devices, count);
+            if (deadline < 0)
+                goto teardown_epoll;
+            if (deadline != armed && arm_timer(timer, deadline) < 0) {
+                perror("timerfd_settime failed");
+                goto teardown_epoll;
+            }
+            armed = deadline;
+        }
+
+        if (output->size && flush_output(output) < 0)
+            goto teardown_epoll;
+    }
+
+    result = 0;
+
+teardown_epoll:
+    if (timer >= 0)
+        close(timer);
+    close(epoll);
+
+    return result;
+}
+
+#ifdef HAVE_LINUX_IO_URING_H
+#define WRITE_DATA UINT64_MAX
+#define TIMER_DATA (UINT64_MAX - 1)
+
+// Mirrors what libevdev does with the events it reads: codes the device doesn't
+// have are ignored, and on SYN_DROPPED the frame being gathered, the rest of
+// the read and whatever the kernel still holds are discarded.
+int gather_read(struct output *output, struct device *device, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        const struct input_event *input = &device->buffer[i];
+
+        if (input->type == EV_SYN && input->code == SYN_DROPPED) {
+            struct pollfd pending = {.fd = device->fd, .events = POLLIN};
+            while (poll(&pending, 1, 0) > 0 &&
+                   read(device->fd, device->buffer, sizeof device->buffer) > 0)
+                ;
+            device->size = 0;
+            return 0;
+        }
+
+        if (!libevdev_has_event_code(device->dev, input->type, input->code))
+            continue;
+
+        if (gather_event(output, device, input) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+void prepare_rw(struct io_uring_sqe *sqe, int write, int fixed, unsigned file,
+                void *data, size_t size, unsigned buffer) {
+    if (write)
+        sqe->opcode = fixed ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+    else
+        sqe->opcode = fixed ? IORING_OP_READ_FIXED : IORING_OP_READ;
+    sqe->flags  = IOSQE_FIXED_FILE;
+    sqe->fd     = file;
+    sqe->off    = -1;
+    sqe->addr   = (uintptr_t)data;
+    sqe->len    = size;
+    if (fixed)
+        sqe->buf_index = buffer;
+}
+
+// Takes a free submission entry, submitting the prepared ones to make room
+// when there's none left. Returns NULL on error.
+struct io_uring_sqe *next_sqe(struct uring *ring) {
+    struct io_uring_sqe *sqe;
+    while (!(sqe = uring_get_sqe(ring)))
+        if (uring_submit(ring, 0) < 0 && errno != EINTR && errno != EAGAIN) {
+            perror("io_uring_enter failed");
+            return NULL;
+        }
+
+    return sqe;
+}
+
+// Same loop as run_multiplexed, but reads from every device and writes to
+// stdout are queued on an io_uring, over registered files and buffers, and
+// reaped in batches: under load completions keep arriving without a single
+// syscall, specially when the kernel polls the submissions itself (SQPOLL).
+// Events are read raw, with gather_read standing in for libevdev, which
+// doesn't cover multitouch slot handling: multitouch devices are refused.
+// Returns 1 when io_uring isn't available, before anything was read.
+int run_uring(struct device *devices, size_t count, struct output *output,
+              int sqpoll) {
+    for (size_t i = 0; i < count; ++i)
+        if (libevdev_has_event_code(devices[i].dev, EV_ABS, ABS_MT_SLOT)) {
+            fprintf(stderr, "io_uring doesn't support multitouch devices like "
+                            "%s, falling back to epoll\n",
+                    libevdev_get_name(devices[i].dev));
+            return 1;
+        }
+
+    struct uring ring;
+    if (uring_init(&ring, 2 * count + 2, sqpoll) < 0) {
+        fprintf(stderr, "io_uring unavailable, falling back to epoll: %s\n",
+                strerror(errno));
+        return 1;
+    }
+
+    int result = -1, timer = -1, fixed = 1;
+    int writing = 0, timer_reading = 0;
+    int64_t armed = INT64_MAX;
+    size_t written = 0;
+    static uint64_t expirations;
+
+    int *files             = calloc(count + 2, sizeof *files);
+    struct iovec *buffers  = calloc(count + 1, sizeof *buffers);
+    unsigned stdout_file   = count, timer_file = count + 1;
+    unsigned output_buffer = count;
+    if (!files || !buffers) {
+        perror("calloc failed");
+        goto teardown_ring;
+    }
+
+    if (is_coalescing(output)) {
+        timer = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+        if (timer < 0) {
+            perror("timerfd_create failed");
+            goto teardown_ring;
+        }
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        files[i]   = devices[i].fd;
+        buffers[i] = (struct iovec){devices[i].buffer,
+                                    sizeof devices[i].buffer};
+    }
+    files[stdout_file]     = STDOUT_FILENO;
+    files[timer_file]      = timer;
+    buffers[output_buffer] = (struct iovec){output->data, OUTPUT_SIZE};
+
+    if (uring_register_files(&ring, files, timer >= 0 ? count + 2 : count + 1) <
+        0) {
+        fprintf(stderr, "io_uring unavailable, falling back to epoll: %s\n",
+                strerror(errno));
+        result = 1;
+        goto teardown_ring;
+    }
+
+    // pinning the buffers may exceed RLIMIT_MEMLOCK, plain reads still do
+    if (uring_register_buffers(&ring, buffers, count + 1) < 0)
+        fixed = 0;
+
+    for (size_t active = count; active > 0 || writing;) {
+        for (size_t i = 0; i < count; ++i) {
+            struct device *device = &devices[i];
+            if (!device->dev || device->reading || device->completed)
+                continue;
+
+            struct io_uring_sqe *sqe = next_sqe(&ring);
+            if (!sqe)
+                goto teardown_ring;
+            prepare_rw(sqe, 0, fixed, i, device->buffer, sizeof device->buffer,
+                       i);
+            sqe->user_data  = i;
+            device->reading = 1;
+        }
+
+        if (uring_submit(&ring, !uring_peek_cqe(&ring)) < 0 &&
+            errno != EINTR) {
+            perror("io_uring_enter failed");
+            goto teardown_ring;
+        }
+
+        for (struct io_uring_cqe *cqe; (cqe = uring_peek_cqe(&ring));
+             uring_cqe_seen(&ring)) {
+            if (cqe->user_data == WRITE_DATA) {
+                if (cqe->res < 0 && cqe->res != -EINTR) {
+                    errno = -cqe->res;
+                    perror("write failed");
+                    goto teardown_ring;
+                }
+                written += cqe->res > 0 ? cqe->res : 0;
+                writing = 0;
+            } else if (cqe->user_data == TIMER_DATA)
+                timer_reading = 0;
+            else {
+                struct device *device = &devices[cqe->user_data];
+                device->reading       = 0;
+                device->completed     = 1;
+                device->result        = cqe->res;
+            }
+        }
+
+        // frames gathered while a write is in flight would be written first
+        if (writing)
+            continue;
+
+        if (written < output->size) {
+            struct io_uring_sqe *sqe = next_sqe(&ring);
+            if (!sqe)
+                goto teardown_ring;
+            prepare_rw(sqe, 1, fixed, stdout_file, output->data + written,
+                       output->size - written, output_buffer);
+            sqe->user_data = WRITE_DATA;
+            writing        = 1;
+            continue;
+        }
+        output->size = written = 0;
+
+        for (size_t i = 0; i < count; ++i) {
+            struct device *device = &devices[i];
+            if (!device->completed)
+                continue;
+            device->completed = 0;
+
+            if (device->result == -EINTR || device->result == -EAGAIN)
+                continue;
+
+            if (device->result <= 0) {
+                if (drop_device(output, device) < 0)
+                    goto teardown_ring;
+                --active;
+                continue;
+            }
+
+            if (gather_read(output, device,
+                            device->result / sizeof(struct input_event)) < 0)
+                goto teardown_ring;
+        }
+
+        if (timer >= 0) {
+            int64_t deadline = flush_due_motion(output, devices, count);
+            if (deadline < 0)
+                goto teardown_ring;
+            if (deadline != armed && arm_timer(timer, deadline) < 0) {
+                perror("timerfd_settime failed");
+                goto teardown_ring;
+            }
+            armed = deadline;
+
+            if (!timer_reading) {
+                struct io_uring_sqe *sqe = next_sqe(&ring);
+                if (!sqe)
+                    goto teardown_ring;
+                prepare_rw(sqe, 0, 0, timer_file, &expirations,
+                           sizeof expirations, 0);
+                sqe->user_data = TIMER_DATA;
+                timer_reading  = 1;
+            }
+        }
+
+        if (output->size) {
+            struct io_uring_sqe *sqe = next_sqe(&ring);
+            if (!sqe)
+                goto teardown_ring;
+            prepare_rw(sqe, 1, fixed, stdout_file, output->data, output->size,
+                       output_buffer);
+            sqe->user_data = WRITE_DATA;
+            writing        = 1;
+        }
+    }
+
+    // anything the last write left out
+    if (written < output->size &&
+        write_all(STDOUT_FILENO, output->data + written,
+                  output->size - written) < 0) {
+        perror("write failed");
+        goto teardown_ring;
+    }
+    output->size = 0;
+
+    result = 0;
+
+teardown_ring:
+    uring_exit(&ring);
+    if (timer >= 0)
+        close(timer);
+    free(buffers);
+    free(files);
+
+    return result;
+}
+#endif
+
 int main(int argc, char *argv[]) {
-    int grab = 0;
+    int grab = 0, monotonic = 0, batch = 0, uring = 0;
+    static struct event_mask mask;
+    static struct output output;
+    struct realtime rt = {0};
 
-    for (int opt; (opt = getopt(argc, argv, "hg")) != -1;) {
+    static const struct option long_options[] = {REALTIME_LONG_OPTION, {0}};
+    for (int opt; (opt = getopt_long(argc, argv, "hgmbTuUt:e:r:l:",
+                                     long_options, NULL)) != -1;) {
         switch (opt) {
             case 'h':
                 return print_usage(stdout, argv[0]), EXIT_SUCCESS;
@@ -32,26 +755,152 @@ int main(int argc, char *argv[]) {
                     break;
                 grab = 1;
                 continue;
+            case 'm':
+                if (monotonic)
+                    break;
+                monotonic = 1;
+                continue;
+            case 'b':
+                if (batch)
+                    break;
+                batch = 1;
+                continue;
+            case 'T':
+                if (output.tagged)
+                    break;
+                output.tagged = 1;
+                continue;
+            case 'u':
+            case 'U':
+                if (uring)
+                    break;
+                uring = opt == 'U' ? 2 : 1;
+                continue;
+            case 't':
+                if (add_type(&mask, optarg) < 0)
+                    break;
+                continue;
+            case 'e':
+                if (add_event(&mask, optarg) < 0)
+                    break;
+                continue;
+            case 'r': {
+                long rate = parse_positive(optarg);
+                if (rate <= 0)
+                    break;
+                output.motion_period = 1000000000 / rate;
+                continue;
+            }
+            case 'l': {
+                long latency = parse_positive(optarg);
+                if (latency <= 0)
+                    break;
+                output.motion_latency = latency * INT64_C(1000);
+                continue;
+            }
+            case REALTIME_OPTION:
+                if (rt.enabled || realtime_parse(&rt, optarg) < 0)
+                    break;
+                continue;
         }
 
         return print_usage(stderr, argv[0]), EXIT_FAILURE;
     }
 
-    if (optind != argc - 1)
+    if (optind == argc)
         return print_usage(stderr, argv[0]), EXIT_FAILURE;
 
-    int fd = open(argv[optind], O_RDONLY);
-    if (fd < 0)
-        return perror("open failed"), EXIT_FAILURE;
+    glob_t devnodes;
+    for (int i = optind; i < argc; ++i)
+        if (glob(argv[i], GLOB_NOCHECK | (i > optind ? GLOB_APPEND : 0), NULL,
+                 &devnodes))
+            return fprintf(stderr, "glob failed for %s\n", argv[i]),
+                   EXIT_FAILURE;
 
     int result = EXIT_FAILURE;
 
-    struct libevdev *dev;
-    if (libevdev_new_from_fd(fd, &dev) < 0)
-        goto teardown_fd;
+    size_t count           = devnodes.gl_pathc;
+    struct device *devices = calloc(count, sizeof *devices);
+    if (!devices) {
+        perror("calloc failed");
+        goto teardown_devnodes;
+    }
 
-    if (grab && libevdev_grab(dev, LIBEVDEV_GRAB) < 0)
-        goto teardown_dev;
+    int multiplexed = batch || uring || output.tagged ||
+                      is_coalescing(&output) || count > 1;
+    for (size_t i = 0; i < count; ++i)
+        devices[i].fd = -1;
+    // devices that fail to be set up are left out, unless all of them do
+    size_t opened = 0;
+    for (size_t i = 0; i < count; ++i) {
+        struct device *device = &devices[opened];
+        const char *devnode   = devnodes.gl_pathv[i];
+        device->tag           = i;
+        device->fd            = open(devnode, multiplexed && !uring
+                                                  ? O_RDONLY | O_NONBLOCK
+                                                  : O_RDONLY);
+        if (device->fd < 0) {
+            fprintf(stderr, "open failed for %s, skipping it: %s\n", devnode,
+                    strerror(errno));
+            continue;
+        }
+
+        if (libevdev_new_from_fd(device->fd, &device->dev) < 0) {
+            fprintf(stderr, "libevdev failed for %s, skipping it\n", devnode);
+            device->dev = NULL;
+        } else if (monotonic &&
+                   libevdev_set_clock_id(device->dev, CLOCK_MONOTONIC) < 0)
+            fprintf(stderr, "EVIOCSCLOCKID failed for %s, skipping it\n",
+                    devnode);
+        else if (mask.enabled && install_mask(device->fd, &mask) < 0)
+            fprintf(stderr, "EVIOCSMASK failed for %s, skipping it\n",
+                    devnode);
+        else if (grab && libevdev_grab(device->dev, LIBEVDEV_GRAB) < 0)
+            fprintf(stderr, "grab failed for %s, skipping it\n", devnode);
+        else {
+            ++opened;
+            continue;
+        }
+
+        libevdev_free(device->dev);
+        device->dev = NULL;
+        close(device->fd);
+        device->fd = -1;
+    }
+
+    if (!opened) {
+        fputs("no device could be opened\n", stderr);
+        goto teardown_devices;
+    }
+    count = opened;
+
+    realtime_apply(&rt);
+
+#ifdef HAVE_LINUX_IO_URING_H
+    if (uring) {
+        int rc = run_uring(devices, count, &output, uring == 2);
+        if (rc <= 0) {
+            if (rc == 0)
+                result = EXIT_SUCCESS;
+            goto teardown_devices;
+        }
+    }
+#else
+    if (uring)
+        fputs("io_uring unavailable, falling back to epoll\n", stderr);
+#endif
+
+    if (uring)
+        for (size_t i = 0; i < count; ++i)
+            fcntl(devices[i].fd, F_SETFL, O_NONBLOCK);
+
+    if (multiplexed) {
+        if (run_multiplexed(devices, count, &output) == 0)
+            result = EXIT_SUCCESS;
+        goto teardown_devices;
+    }
+
+    struct libevdev *dev = devices[0].dev;
 
     setbuf(stdout, NULL);
     for (;;) {
@@ -70,18 +919,24 @@ int main(int argc, char *argv[]) {
             break;
 
         if (fwrite(&input, sizeof input, 1, stdout) != 1)
-            goto teardown_grab;
+            goto teardown_devices;
     }
 
     result = EXIT_SUCCESS;
 
-teardown_grab:
-    if (grab)
-        libevdev_grab(dev, LIBEVDEV_UNGRAB);
-teardown_dev:
-    libevdev_free(dev);
-teardown_fd:
-    close(fd);
+teardown_devices:
+    for (size_t i = 0; i < count; ++i) {
+        if (devices[i].dev) {
+            if (grab)
+                libevdev_grab(devices[i].dev, LIBEVDEV_UNGRAB);
+            libevdev_free(devices[i].dev);
+        }
+        if (devices[i].fd >= 0)
+            close(devices[i].fd);
+    }
+    free(devices);
+teardown_devnodes:
+    globfree(&devnodes);
 
     return result;
 }
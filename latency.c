@@ -0,0 +1,153 @@
+#include <time.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <unistd.h>
+
+#include "latency.h"
+
+// Ages are kept in microseconds, in 16 buckets per power of two, which bounds
+// the error of the reported percentiles to about 6%.
+#define SUB_BITS 4
+#define SUB_COUNT (1 << SUB_BITS)
+#define BUCKETS ((64 - SUB_BITS + 1) * SUB_COUNT)
+
+static struct {
+    const char *stage;
+    pid_t pid;
+    uint64_t count, skipped, max;
+    uint64_t buckets[BUCKETS];
+} latency;
+
+static unsigned bucket_of(uint64_t age) {
+    if (age < SUB_COUNT)
+        return age;
+
+    unsigned msb = 63 - __builtin_clzll(age);
+    return (msb - SUB_BITS + 1) * SUB_COUNT +
+           (age >> (msb - SUB_BITS) & (SUB_COUNT - 1));
+}
+
+static uint64_t bucket_top(unsigned bucket) {
+    if (bucket < SUB_COUNT)
+        return bucket;
+
+    unsigned shift = bucket / SUB_COUNT - 1;
+    return ((uint64_t)(SUB_COUNT + bucket % SUB_COUNT + 1) << shift) - 1;
+}
+
+static uint64_t percentile(unsigned percent) {
+    uint64_t rank = (latency.count * percent + 99) / 100, seen = 0;
+    for (unsigned bucket = 0; bucket < BUCKETS; ++bucket) {
+        seen += latency.buckets[bucket];
+        if (seen >= rank) {
+            uint64_t top = bucket_top(bucket);
+            return top < latency.max ? top : latency.max;
+        }
+    }
+
+    return latency.max;
+}
+
+void latency_record(long sec, long usec) {
+    if (!sec && !usec) {
+        ++latency.skipped;
+        return;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    int64_t age = (now.tv_sec - (int64_t)sec) * INT64_C(1000000) +
+                  now.tv_nsec / 1000 - usec;
+
+    // events stamped with another clock than the monotonic one
+    if (age < 0 || age > INT64_C(3600000000)) {
+        ++latency.skipped;
+        return;
+    }
+
+    ++latency.count;
+    ++latency.buckets[bucket_of(age)];
+    if ((uint64_t)age > latency.max)
+        latency.max = age;
+}
+
+static char *append(char *p, const char *s) {
+    while (*s)
+        *p++ = *s++;
+    return p;
+}
+
+static char *append_number(char *p, uint64_t n) {
+    char digits[20];
+    int i = 0;
+    do
+        digits[i++] = '0' + n % 10;
+    while (n /= 10);
+    while (i)
+        *p++ = digits[--i];
+    return p;
+}
+
+// Formats by hand and writes with a single write(2) so that it can be called
+// from the signal handlers.
+void latency_dump(void) {
+    char line[512], *p = line;
+
+    p = append(p, latency.stage);
+    p = append(p, "[");
+    p = append_number(p, latency.pid);
+    p = append(p, "]: ");
+    p = append_number(p, latency.count);
+    p = append(p, " events");
+    if (latency.count) {
+        p = append(p, ", p50 ");
+        p = append_number(p, percentile(50));
+        p = append(p, "us, p99 ");
+        p = append_number(p, percentile(99));
+        p = append(p, "us, max ");
+        p = append_number(p, latency.max);
+        p = append(p, "us");
+    }
+    if (latency.skipped) {
+        p = append(p, ", ");
+        p = append_number(p, latency.skipped);
+        p = append(p, " not monotonic");
+    }
+    p = append(p, "\n");
+
+    ssize_t written = write(STDERR_FILENO, line, p - line);
+    (void)written;
+}
+
+static void on_signal(int signal) {
+    int saved_errno = errno;
+
+    latency_dump();
+
+    if (signal != SIGUSR1) {
+        struct sigaction action = {.sa_handler = SIG_DFL};
+        sigaction(signal, &action, NULL);
+        raise(signal);
+    }
+
+    errno = saved_errno;
+}
+
+void latency_init(const char *stage) {
+    const char *slash = strrchr(stage, '/');
+    latency.stage     = slash ? slash + 1 : stage;
+    latency.pid       = getpid();
+
+    struct sigaction action = {.sa_handler = on_signal,
+                               .sa_flags   = SA_RESTART};
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGUSR1, &action, NULL);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    atexit(latency_dump);
+}
@@ -0,0 +1,19 @@
+#ifndef INTERCEPTION_LATENCY_H
+#define INTERCEPTION_LATENCY_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Histogram of the age of the events a tool emits, measured against their
+// CLOCK_MONOTONIC timestamps (see `intercept -m`) and dumped to stderr on
+// SIGUSR1 and on exit.
+void latency_init(const char *stage);
+void latency_record(long sec, long usec);
+void latency_dump(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -1,77 +1,298 @@
 #include <map>
+#include <ctime>
+#include <deque>
 #include <atomic>
 #include <cstdio>
 #include <memory>
 #include <string>
 #include <thread>
 #include <vector>
+#include <utility>
 #include <cstdlib>
+#include <cinttypes>
 #include <stdexcept>
 
 extern "C" {
+#include <poll.h>
 #include <unistd.h>
 #include <linux/input.h>
 }
 
-#include <boost/interprocess/ipc/message_queue.hpp>
-
-using boost::interprocess::open_only;
-using boost::interprocess::create_only;
-using boost::interprocess::message_queue;
+#include "graph.hpp"
+#include "queue.hpp"
+#include "latency.h"
+#include "realtime.h"
 
 void print_usage(std::FILE *stream, const char *program) {
     // clang-format off
     std::fprintf(stream,
                  "mux - mux streams of input events\n"
                  "\n"
-                 "usage: %s [-h | [-s size] -c name | [-i name] [-o name]]\n"
+                 "usage: %s [-h | [-t type] [-s size] [-p policy] [-P n] -c name |\n"
+                 "           [--rt[=spec]] -g graph.yaml | -S name |\n"
+                 "           [-L] [--rt[=spec]] [-w ms] [-i name] [-o name]]\n"
                  "\n"
                  "options:\n"
                  "    -h        show this message and exit\n"
-                 "    -s size   muxer's queue size (default: 100)\n"
+                 "    -t type   muxer's queue type, ring, broadcast for a ring whose\n"
+                 "              readers all get every event, or mq for boost's\n"
+                 "              message queue (default: ring)\n"
+                 "    -s size   muxer's queue size in frames (default: 100)\n"
+                 "    -p policy what muxer does with a frame that doesn't fit: fail,\n"
+                 "              block[:ms], drop-oldest, drop-newest or coalesce[:ms],\n"
+                 "              merging motion frames while other frames block, not\n"
+                 "              for mq (default: fail, ms: 100)\n"
+                 "    -P n      give the ring priority lanes, key frames overtaking\n"
+                 "              others and those overtaking motion, a lower lane\n"
+                 "              waiting for at most n frames of higher ones\n"
                  "    -c name   name of muxer to create (repeatable)\n"
                  "    -i name   name of muxer to read input from or switch on\n"
-                 "              (repeatable in switch mode)\n"
-                 "    -o name   name of muxer to write output to (repeatable)\n",
+                 "              (repeatable, merging by timestamp, or in switch mode)\n"
+                 "    -o name   name of muxer to write output to (repeatable)\n"
+                 "    -g graph.yaml\n"
+                 "              run the routing graph in graph.yaml in process,\n"
+                 "              creating its queues and launching its commands\n"
+                 "    -w ms     how long merging holds a frame back waiting for older\n"
+                 "              ones from other muxers (default: 1)\n"
+                 "    -S name   print the counters of muxer, how full it is and got,\n"
+                 "              how often frames didn't fit and the longest a frame\n"
+                 "              waited for a reader (repeatable)\n"
+                 "    -L        measure the age of forwarded events, see intercept\n"
+                 "              -m, dumping percentiles on SIGUSR1 and exit\n"
+                 "    --rt[=spec]\n"
+                 "              run realtime with locked memory, spec being\n"
+                 "              [fifo|rr][:prio][@cpulist] (default: fifo:10)\n",
                  program);
     // clang-format on
 }
 
 std::atomic<size_t> current_muxer{0};
 
+// how often the selector thread checks for input having ended
+constexpr int stop_check_ms = 100;
+
+bool is_frame_end(const input_event &event) {
+    return event.type == EV_SYN && event.code == SYN_REPORT;
+}
+
+// Reads events from stdin and hands them over to send a whole frame at a
+// time, so that queues split long frames themselves, or as far as
+// max_pending events of one missing its end. While flush tells of frames
+// held back by the queues, it's retried every millisecond until input comes.
+template <typename F, typename G>
+void read_frames(F send, G flush) {
+    constexpr size_t max_pending = 16 * event_queue::max_frame;
+
+    std::setbuf(stdin, nullptr);
+
+    std::vector<input_event> frame;
+    input_event event;
+    for (;;) {
+        for (pollfd pfd = {STDIN_FILENO, POLLIN, 0}; !flush();)
+            if (poll(&pfd, 1, 1) > 0)
+                break;
+
+        if (std::fread(&event, sizeof event, 1, stdin) == 1) {
+            frame.push_back(event);
+            if (frame.size() < max_pending && !is_frame_end(event))
+                continue;
+            send(frame.data(), frame.size());
+            frame.clear();
+        } else if (std::ferror(stdin))
+            throw std::runtime_error("error reading input event from stdin");
+        else if (std::feof(stdin)) {
+            if (!frame.empty())
+                send(frame.data(), frame.size());
+            break;
+        }
+    }
+}
+
+// Flushes every queue, telling whether none holds frames back anymore.
+bool flush_all(const std::vector<std::unique_ptr<event_queue>> &queues) {
+    bool flushed = true;
+    for (auto &queue : queues)
+        flushed = queue->flush() && flushed;
+    return flushed;
+}
+
+struct pending_frame {
+    int64_t arrival;
+    size_t count;
+    input_event events[event_queue::max_frame];
+};
+
+int64_t monotonic_now() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * INT64_C(1000000000) + ts.tv_nsec;
+}
+
+bool is_older(const pending_frame &a, const pending_frame &b) {
+    const input_event &x = a.events[a.count - 1], &y = b.events[b.count - 1];
+    return x.input_event_sec != y.input_event_sec
+               ? x.input_event_sec < y.input_event_sec
+               : x.input_event_usec < y.input_event_usec;
+}
+
+// Receives frames from all queues and hands them over to write oldest first.
+// The oldest frame waits for the other queues to have a frame to compare it
+// with for up to window ms, after which it goes as is. Once the first part of
+// a frame longer than a queue's max_frame is written, only its queue is
+// written until the frame ends, so that frames never interleave.
+template <typename F>
+void merge_frames(const std::vector<std::unique_ptr<event_queue>> &queues,
+                  unsigned int window, F write) {
+    std::vector<std::deque<pending_frame>> pending(queues.size());
+    std::deque<pending_frame> *unfinished = nullptr;
+    int64_t window_ns = window * INT64_C(1000000);
+    pending_frame frame;
+    size_t next = 0;
+    for (;;) {
+        int64_t now = monotonic_now(), deadline = -1;
+        for (;;) {
+            std::deque<pending_frame> *oldest = unfinished;
+            bool complete                     = true;
+            for (auto &frames : pending) {
+                if (unfinished)
+                    break;
+                if (frames.empty())
+                    complete = false;
+                else if (!oldest || is_older(frames.front(), oldest->front()))
+                    oldest = &frames;
+            }
+            if (!oldest || oldest->empty())
+                break;
+            if (!complete && now - oldest->front().arrival < window_ns) {
+                deadline = oldest->front().arrival + window_ns;
+                break;
+            }
+            const pending_frame &first = oldest->front();
+            write(first.events, first.count);
+            unfinished =
+                is_frame_end(first.events[first.count - 1]) ? nullptr : oldest;
+            oldest->pop_front();
+        }
+
+        // queues with nothing pending are read first, so that the oldest
+        // frame gets compared with theirs instead of waiting for the window
+        bool received = false;
+        for (size_t id = 0; id < queues.size(); ++id)
+            if (pending[id].empty() &&
+                (frame.count = queues[id]->try_receive(frame.events))) {
+                frame.arrival = monotonic_now();
+                pending[id].push_back(frame);
+                received = true;
+            }
+        if (received)
+            continue;
+
+        int timeout = deadline < 0 ? -1 : (deadline - now + 999999) / 1000000;
+        size_t id   = event_queue::receive_any(queues, frame.events,
+                                               frame.count, next, timeout);
+        if (id == queues.size())
+            continue;
+        frame.arrival = monotonic_now();
+        pending[id].push_back(frame);
+    }
+}
+
 int main(int argc, char *argv[]) try {
     enum {
         NO_MODE,
         CREATE_MODE,
         INPUT_MODE,
         OUTPUT_MODE,
-        SWITCH_MODE
+        SWITCH_MODE,
+        GRAPH_MODE,
+        STATS_MODE
     } mode = NO_MODE;
 
     std::map<std::string, std::vector<std::string>> muxer_names;
     std::vector<size_t> muxer_sizes;
     size_t muxer_size = 100;
+    std::vector<event_queue::type> muxer_types;
+    event_queue::type muxer_type = event_queue::ring;
+    std::vector<std::pair<event_queue::policy, unsigned int>> muxer_policies;
+    event_queue::policy muxer_policy = event_queue::fail;
+    unsigned int muxer_timeout       = 0;
+    std::vector<unsigned int> muxer_starvations;
+    unsigned int muxer_starvation = 0;
+
+    realtime rt{};
+    bool measure        = false;
+    unsigned int window = 1;
+    bool window_set     = false;
+    std::string graph_path;
 
     std::vector<std::string> input_muxer_names = {""};
+    static const option long_options[]         = {REALTIME_LONG_OPTION, {}};
     for (int opt, last_opt = 0;
-         (opt = getopt(argc, argv, "hs:c:i:o:")) != -1;) {
+         (opt = getopt_long(argc, argv, "ht:s:p:P:c:i:o:g:w:S:L", long_options,
+                            nullptr)) != -1;) {
         switch (opt) {
             case 'h':
                 return print_usage(stdout, argv[0]), EXIT_SUCCESS;
+            case 'L':
+                if (measure)
+                    break;
+                measure = true;
+                continue;
+            case 'w':
+                if (window_set)
+                    break;
+                window     = std::stoul(optarg);
+                window_set = true;
+                continue;
+            case REALTIME_OPTION:
+                if (rt.enabled || realtime_parse(&rt, optarg) < 0)
+                    break;
+                continue;
+            case 't':
+                if (last_opt && last_opt != 'c' && last_opt != 's' &&
+                    last_opt != 'p' && last_opt != 'P')
+                    break;
+
+                if (!event_queue::parse_type(optarg, muxer_type))
+                    break;
+                last_opt = 't';
+                continue;
             case 's':
-                if (last_opt && last_opt != 'c')
+                if (last_opt && last_opt != 'c' && last_opt != 't' &&
+                    last_opt != 'p' && last_opt != 'P')
                     break;
 
                 muxer_size = std::stoul(optarg);
                 last_opt   = 's';
                 continue;
+            case 'p':
+                if ((last_opt && last_opt != 'c' && last_opt != 't' &&
+                     last_opt != 's' && last_opt != 'P') ||
+                    !event_queue::parse_policy(optarg, muxer_policy,
+                                               muxer_timeout))
+                    break;
+
+                last_opt = 'p';
+                continue;
+            case 'P':
+                if (last_opt && last_opt != 'c' && last_opt != 't' &&
+                    last_opt != 's' && last_opt != 'p')
+                    break;
+
+                muxer_starvation = std::stoul(optarg);
+                last_opt         = 'P';
+                continue;
             case 'c':
-                if (last_opt && last_opt != 'c' && last_opt != 's')
+                if (last_opt && last_opt != 'c' && last_opt != 's' &&
+                    last_opt != 't' && last_opt != 'p' && last_opt != 'P')
                     break;
 
                 mode = CREATE_MODE;
                 muxer_names[""].push_back(optarg);
                 muxer_sizes.push_back(muxer_size);
+                muxer_types.push_back(muxer_type);
+                muxer_policies.emplace_back(muxer_policy, muxer_timeout);
+                muxer_starvations.push_back(muxer_starvation);
                 last_opt = 'c';
                 continue;
             case 'i':
@@ -104,124 +325,201 @@ int main(int argc, char *argv[]) try {
 
                 last_opt = 'o';
                 continue;
+            case 'g':
+                if (last_opt)
+                    break;
+
+                mode       = GRAPH_MODE;
+                graph_path = optarg;
+                last_opt   = 'g';
+                continue;
+            case 'S':
+                if (last_opt && last_opt != 'S')
+                    break;
+
+                mode = STATS_MODE;
+                muxer_names[""].push_back(optarg);
+                last_opt = 'S';
+                continue;
         }
 
         return print_usage(stderr, argv[0]), EXIT_FAILURE;
     }
 
+    if (((mode == CREATE_MODE || mode == STATS_MODE) &&
+         (rt.enabled || measure)) ||
+        (mode == GRAPH_MODE && measure) || (window_set && mode != INPUT_MODE))
+        return print_usage(stderr, argv[0]), EXIT_FAILURE;
+
+    if (measure)
+        latency_init(argv[0]);
+
     switch (mode) {
         case NO_MODE:
             return print_usage(stderr, argv[0]), EXIT_FAILURE;
 
         case CREATE_MODE: {
-            auto muxer_size = muxer_sizes.begin();
+            auto muxer_size   = muxer_sizes.begin();
+            auto muxer_type   = muxer_types.begin();
+            auto muxer_policy     = muxer_policies.begin();
+            auto muxer_starvation = muxer_starvations.begin();
             for (const auto &muxer_name : muxer_names[""]) {
-                message_queue::remove(muxer_name.c_str());
-                message_queue(create_only, muxer_name.c_str(), *muxer_size,
-                              sizeof(input_event), 0600);
-                ++muxer_size;
+                event_queue::create(muxer_name, *muxer_type++, *muxer_size++,
+                                    muxer_policy->first, muxer_policy->second,
+                                    *muxer_starvation++);
+                ++muxer_policy;
             }
         } break;
 
         case INPUT_MODE: {
-            if (muxer_names.size() != 1)
-                return print_usage(stderr, argv[0]), EXIT_FAILURE;
+            std::vector<std::unique_ptr<event_queue>> muxers;
+            for (const auto &muxer_name : muxer_names)
+                muxers.push_back(event_queue::open(muxer_name.first));
 
-            message_queue muxer(open_only, muxer_names.begin()->first.c_str());
+            realtime_apply(&rt);
 
             std::setbuf(stdout, nullptr);
-            input_event input;
-            unsigned int priority;
-            message_queue::size_type size;
-            for (;;) {
-                muxer.receive(&input, sizeof input, size, priority);
-                if (size != sizeof input)
-                    throw std::runtime_error(
-                        "unexpected input event size while reading from input "
-                        "event queue");
-                else if (std::fwrite(&input, sizeof input, 1, stdout) != 1)
+            auto write = [&](const input_event *frame, size_t count) {
+                if (std::fwrite(frame, sizeof *frame, count, stdout) != count)
                     throw std::runtime_error(
                         "error writing input event to stdout");
-            }
+                else if (measure)
+                    for (size_t i = 0; i < count; ++i)
+                        latency_record(frame[i].input_event_sec,
+                                       frame[i].input_event_usec);
+            };
+
+            input_event frame[event_queue::max_frame];
+            if (muxers.size() > 1)
+                merge_frames(muxers, window, write);
+            else
+                for (;;)
+                    write(frame, muxers.front()->receive(frame));
         } break;
 
         case OUTPUT_MODE: {
-            std::vector<std::unique_ptr<message_queue>> muxers;
+            std::vector<std::unique_ptr<event_queue>> muxers;
 
             for (const auto &muxer_name : muxer_names[""])
-                muxers.emplace_back(
-                    new message_queue(open_only, muxer_name.c_str()));
+                muxers.push_back(event_queue::open(muxer_name));
+
+            realtime_apply(&rt);
 
-            std::setbuf(stdin, nullptr);
-            input_event input;
-            for (;;)
-                if (std::fread(&input, sizeof input, 1, stdin) == 1) {
+            read_frames(
+                [&](const input_event *frame, size_t count) {
                     for (auto &muxer : muxers)
-                        if (!muxer->try_send(&input, sizeof input, 0))
+                        if (!muxer->send(frame, count))
                             throw std::runtime_error(
                                 "outgoing muxer is full, exiting");
-                } else if (std::ferror(stdin))
-                    throw std::runtime_error(
-                        "error reading input event from stdin");
-                else if (std::feof(stdin))
-                    break;
+                    if (measure)
+                        for (size_t i = 0; i < count; ++i)
+                            latency_record(frame[i].input_event_sec,
+                                           frame[i].input_event_usec);
+                },
+                [&]() { return flush_all(muxers); });
         } break;
 
         case SWITCH_MODE: {
-            std::vector<std::vector<std::unique_ptr<message_queue>>> muxers;
+            std::vector<std::vector<std::unique_ptr<event_queue>>> muxers;
 
             muxers.emplace_back();
             for (const auto &muxer_name : muxer_names[""])
-                muxers.back().emplace_back(
-                    new message_queue(open_only, muxer_name.c_str()));
+                muxers.back().push_back(event_queue::open(muxer_name));
 
-            size_t id = 0;
+            // the selector thread inherits the scheduling of this one
+            realtime_apply(&rt);
+
+            std::vector<std::unique_ptr<event_queue>> selectors;
             for (const auto &muxer_name : muxer_names) {
                 if (muxer_name.first.empty())
                     continue;
 
                 muxers.emplace_back();
                 for (const auto &name : muxer_name.second)
-                    muxers.back().emplace_back(
-                        new message_queue(open_only, name.c_str()));
-
-                std::thread(
-                    [](std::unique_ptr<message_queue> muxer, size_t id) {
-                        try {
-                            input_event input;
-                            unsigned int priority;
-                            message_queue::size_type size;
-                            for (;;) {
-                                muxer->receive(&input, sizeof input, size,
-                                               priority);
-                                if (size == sizeof input)
-                                    current_muxer = id;
-                            }
-                        } catch (...) {
-                        }
-                    },
-                    std::unique_ptr<message_queue>(
-                        new message_queue(open_only, muxer_name.first.c_str())),
-                    ++id)
-                    .detach();
+                    muxers.back().push_back(event_queue::open(name));
+                selectors.push_back(event_queue::open(muxer_name.first));
             }
 
-            std::setbuf(stdin, nullptr);
+            // a single thread waits on every selector, and frames pick up the
+            // switch as they start, so that none is split across muxers
+            std::atomic<bool> stopping{false};
+            std::thread selector(
+                [&stopping](
+                    std::vector<std::unique_ptr<event_queue>> selectors) {
+                    try {
+                        input_event frame[event_queue::max_frame];
+                        size_t count, next = 0;
+                        while (!stopping) {
+                            size_t id = event_queue::receive_any(
+                                selectors, frame, count, next, stop_check_ms);
+                            if (id < selectors.size())
+                                current_muxer = id + 1;
+                        }
+                    } catch (...) {
+                    }
+                },
+                std::move(selectors));
+            struct stopper {
+                std::atomic<bool> &stopping;
+                std::thread &thread;
+                ~stopper() {
+                    stopping = true;
+                    thread.join();
+                }
+            } stopper{stopping, selector};
 
-            input_event input;
-            for (;;)
-                if (std::fread(&input, sizeof input, 1, stdin) == 1) {
+            read_frames(
+                [&](const input_event *frame, size_t count) {
                     size_t current = current_muxer;
                     for (auto &muxer : muxers[current])
-                        if (!muxer->try_send(&input, sizeof input, 0))
+                        if (!muxer->send(frame, count))
                             throw std::runtime_error(
                                 "outgoing muxer is full, exiting");
-                } else if (std::ferror(stdin))
-                    throw std::runtime_error(
-                        "error reading input event from stdin");
-                else if (std::feof(stdin))
-                    break;
+                    if (measure)
+                        for (size_t i = 0; i < count; ++i)
+                            latency_record(frame[i].input_event_sec,
+                                           frame[i].input_event_usec);
+                },
+                [&]() {
+                    bool flushed = true;
+                    for (auto &set : muxers)
+                        flushed = flush_all(set) && flushed;
+                    return flushed;
+                });
         } break;
+
+        case GRAPH_MODE: {
+            event_graph graph(YAML::LoadFile(graph_path));
+
+            // commands and the queue thread inherit the scheduling of this one
+            realtime_apply(&rt);
+
+            graph.run();
+        } break;
+
+        case STATS_MODE:
+            for (const auto &muxer_name : muxer_names[""]) {
+                auto stats = event_queue::open(muxer_name)->stats();
+                std::printf("%s:\n"
+                            "  capacity: %" PRIu64 "\n"
+                            "  used: %" PRIu64 "\n"
+                            "  enqueued: %" PRIu64 "\n"
+                            "  dequeued: %" PRIu64 "\n"
+                            "  high_water: %" PRIu64 "\n"
+                            "  full: %" PRIu64 "\n"
+                            "  blocked: %" PRIu64 "\n"
+                            "  timed_out: %" PRIu64 "\n"
+                            "  dropped_oldest: %" PRIu64 "\n"
+                            "  dropped_newest: %" PRIu64 "\n"
+                            "  coalesced: %" PRIu64 "\n"
+                            "  max_wait_us: %" PRIu64 "\n",
+                            muxer_name.c_str(), stats.capacity, stats.used,
+                            stats.enqueued, stats.dequeued, stats.high_water,
+                            stats.full, stats.blocked, stats.timed_out,
+                            stats.dropped_oldest, stats.dropped_newest,
+                            stats.coalesced, stats.max_wait_us);
+            }
+            break;
     }
 } catch (const std::exception &e) {
     return std::fprintf(stderr,
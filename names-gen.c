@@ -0,0 +1,232 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libevdev/libevdev.h>
+
+#include "names.h"
+
+// Generates the perfect hash table behind names.c from the names libevdev
+// knows for event types, codes and properties, plus the bus types below.
+// Every key first picks a bucket, and every bucket a seed under which its keys
+// land on slots no other key uses, found here by trying seeds in turn.
+
+struct key {
+    const char *name;
+    int kind, type, value;
+    uint32_t bucket;
+};
+
+static const struct {
+    const char *name;
+    int value;
+} buses[] = {
+#ifdef BUS_PCI
+    {"BUS_PCI", BUS_PCI},
+#endif
+#ifdef BUS_ISAPNP
+    {"BUS_ISAPNP", BUS_ISAPNP},
+#endif
+#ifdef BUS_USB
+    {"BUS_USB", BUS_USB},
+#endif
+#ifdef BUS_HIL
+    {"BUS_HIL", BUS_HIL},
+#endif
+#ifdef BUS_BLUETOOTH
+    {"BUS_BLUETOOTH", BUS_BLUETOOTH},
+#endif
+#ifdef BUS_VIRTUAL
+    {"BUS_VIRTUAL", BUS_VIRTUAL},
+#endif
+#ifdef BUS_ISA
+    {"BUS_ISA", BUS_ISA},
+#endif
+#ifdef BUS_I8042
+    {"BUS_I8042", BUS_I8042},
+#endif
+#ifdef BUS_XTKBD
+    {"BUS_XTKBD", BUS_XTKBD},
+#endif
+#ifdef BUS_RS232
+    {"BUS_RS232", BUS_RS232},
+#endif
+#ifdef BUS_GAMEPORT
+    {"BUS_GAMEPORT", BUS_GAMEPORT},
+#endif
+#ifdef BUS_PARPORT
+    {"BUS_PARPORT", BUS_PARPORT},
+#endif
+#ifdef BUS_AMIGA
+    {"BUS_AMIGA", BUS_AMIGA},
+#endif
+#ifdef BUS_ADB
+    {"BUS_ADB", BUS_ADB},
+#endif
+#ifdef BUS_I2C
+    {"BUS_I2C", BUS_I2C},
+#endif
+#ifdef BUS_HOST
+    {"BUS_HOST", BUS_HOST},
+#endif
+#ifdef BUS_GSC
+    {"BUS_GSC", BUS_GSC},
+#endif
+#ifdef BUS_ATARI
+    {"BUS_ATARI", BUS_ATARI},
+#endif
+#ifdef BUS_SPI
+    {"BUS_SPI", BUS_SPI},
+#endif
+#ifdef BUS_RMI
+    {"BUS_RMI", BUS_RMI},
+#endif
+#ifdef BUS_CEC
+    {"BUS_CEC", BUS_CEC},
+#endif
+#ifdef BUS_INTEL_ISHTP
+    {"BUS_INTEL_ISHTP", BUS_INTEL_ISHTP},
+#endif
+};
+
+static struct key *keys;
+static size_t count, capacity;
+
+static void add_key(const char *name, int kind, int type, int value) {
+    if (!name)
+        return;
+
+    for (size_t i = 0; i < count; ++i)
+        if (!strcmp(keys[i].name, name))
+            return;
+
+    if (count == capacity) {
+        capacity = capacity ? capacity * 2 : 1024;
+        keys     = realloc(keys, capacity * sizeof *keys);
+        if (!keys) {
+            perror("realloc failed");
+            exit(EXIT_FAILURE);
+        }
+    }
+    keys[count++] = (struct key){name, kind, type, value, 0};
+}
+
+static size_t bucket_count, slot_count;
+static uint32_t *seeds;
+static struct key **slots;
+
+static int place_bucket(uint32_t bucket, uint32_t seed, size_t *taken,
+                        size_t *n) {
+    *n = 0;
+    for (size_t i = 0; i < count; ++i) {
+        if (keys[i].bucket != bucket)
+            continue;
+        size_t slot = names_hash(seed, keys[i].name) % slot_count;
+        if (slots[slot])
+            return -1;
+        for (size_t j = 0; j < *n; ++j)
+            if (taken[j] == slot)
+                return -1;
+        taken[(*n)++] = slot;
+    }
+
+    return 0;
+}
+
+static int build(void) {
+    size_t *sizes = calloc(bucket_count, sizeof *sizes);
+    size_t *taken = calloc(count, sizeof *taken);
+    if (!sizes || !taken)
+        return -1;
+
+    for (size_t i = 0; i < count; ++i) {
+        keys[i].bucket = names_hash(0, keys[i].name) % bucket_count;
+        ++sizes[keys[i].bucket];
+    }
+
+    // biggest buckets first, while most slots are still free
+    for (size_t size = count; size > 0; --size)
+        for (uint32_t bucket = 0; bucket < bucket_count; ++bucket) {
+            if (sizes[bucket] != size)
+                continue;
+
+            uint32_t seed = 1;
+            size_t n;
+            while (place_bucket(bucket, seed, taken, &n) < 0)
+                if (++seed == UINT32_MAX)
+                    return -1;
+
+            seeds[bucket] = seed;
+            for (size_t i = 0, j = 0; i < count; ++i)
+                if (keys[i].bucket == bucket)
+                    slots[taken[j++]] = &keys[i];
+        }
+
+    free(taken);
+    free(sizes);
+
+    return 0;
+}
+
+static const char *kind_names[] = {"NAME_EVENT_TYPE", "NAME_EVENT_CODE",
+                                   "NAME_PROPERTY", "NAME_BUS"};
+
+int main(int argc, char *argv[]) {
+    if (argc != 2)
+        return fprintf(stderr, "usage: %s names-table.h\n", argv[0]),
+               EXIT_FAILURE;
+
+    for (int type = 0; type <= EV_MAX; ++type) {
+        const char *type_name = libevdev_event_type_get_name(type);
+        if (!type_name)
+            continue;
+        add_key(type_name, NAME_EVENT_TYPE, type, type);
+        int max = libevdev_event_type_get_max(type);
+        for (int code = 0; code <= max; ++code)
+            add_key(libevdev_event_code_get_name(type, code), NAME_EVENT_CODE,
+                    type, code);
+    }
+    for (int property = 0; property <= INPUT_PROP_MAX; ++property)
+        add_key(libevdev_property_get_name(property), NAME_PROPERTY, 0,
+                property);
+    int bus_max = 0;
+    for (size_t i = 0; i < sizeof buses / sizeof *buses; ++i) {
+        add_key(buses[i].name, NAME_BUS, 0, buses[i].value);
+        if (buses[i].value > bus_max)
+            bus_max = buses[i].value;
+    }
+
+    bucket_count = count / 4 + 1;
+    slot_count   = count;
+    seeds        = calloc(bucket_count, sizeof *seeds);
+    slots        = calloc(slot_count, sizeof *slots);
+    if (!seeds || !slots || build() < 0)
+        return fputs("no perfect hash found\n", stderr), EXIT_FAILURE;
+
+    FILE *out = fopen(argv[1], "w");
+    if (!out)
+        return perror("fopen failed"), EXIT_FAILURE;
+
+    fprintf(out, "// generated by names-gen, do not edit\n\n");
+    fprintf(out, "#define NAMES_BUCKETS %zu\n", bucket_count);
+    fprintf(out, "#define NAMES_SLOTS %zu\n\n", slot_count);
+    fprintf(out, "static const uint32_t names_seeds[NAMES_BUCKETS] = {\n");
+    for (size_t i = 0; i < bucket_count; ++i)
+        fprintf(out, "    %u,\n", seeds[i]);
+    fprintf(out, "};\n\n");
+    fprintf(out, "static const struct name names_slots[NAMES_SLOTS] = {\n");
+    for (size_t i = 0; i < slot_count; ++i)
+        fprintf(out, "    {\"%s\", %s, %d, %d},\n", slots[i]->name,
+                kind_names[slots[i]->kind], slots[i]->type, slots[i]->value);
+    fprintf(out, "};\n\n");
+    fprintf(out, "static const char *const names_buses[%d] = {\n", bus_max + 1);
+    for (size_t i = 0; i < sizeof buses / sizeof *buses; ++i)
+        fprintf(out, "    [%d] = \"%s\",\n", buses[i].value, buses[i].name);
+    fprintf(out, "};\n");
+
+    if (fclose(out) != 0)
+        return perror("fclose failed"), EXIT_FAILURE;
+
+    return EXIT_SUCCESS;
+}
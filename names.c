@@ -0,0 +1,50 @@
+#include <string.h>
+
+#include <libevdev/libevdev.h>
+
+#include "names.h"
+#include "names-table.h"
+
+static const struct name *find(const char *name) {
+    uint32_t seed = names_seeds[names_hash(0, name) % NAMES_BUCKETS];
+    const struct name *slot =
+        &names_slots[names_hash(seed, name) % NAMES_SLOTS];
+    return strcmp(slot->name, name) ? NULL : slot;
+}
+
+int event_type_from_name(const char *name) {
+    const struct name *found = find(name);
+    if (!found)
+        return libevdev_event_type_from_name(name);
+
+    return found->kind == NAME_EVENT_TYPE ? found->value : -1;
+}
+
+int event_code_from_name(int type, const char *name) {
+    const struct name *found = find(name);
+    if (!found)
+        return libevdev_event_code_from_name(type, name);
+
+    return found->kind == NAME_EVENT_CODE && found->type == type ? found->value
+                                                                 : -1;
+}
+
+int property_from_name(const char *name) {
+    const struct name *found = find(name);
+    if (!found)
+        return libevdev_property_from_name(name);
+
+    return found->kind == NAME_PROPERTY ? found->value : -1;
+}
+
+int bus_from_name(const char *name) {
+    const struct name *found = find(name);
+    return found && found->kind == NAME_BUS ? found->value : -1;
+}
+
+const char *bus_get_name(int bus) {
+    if (bus < 0 || bus >= (int)(sizeof names_buses / sizeof *names_buses))
+        return NULL;
+
+    return names_buses[bus];
+}
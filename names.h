@@ -0,0 +1,44 @@
+#ifndef INTERCEPTION_NAMES_H
+#define INTERCEPTION_NAMES_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Lookup of event type, event code, property and bus type names through a
+// perfect hash table generated at build time by names-gen, falling back to
+// libevdev for the aliases it doesn't hold. All return -1 for unknown names.
+enum name_kind {
+    NAME_EVENT_TYPE,
+    NAME_EVENT_CODE,
+    NAME_PROPERTY,
+    NAME_BUS,
+};
+
+struct name {
+    const char *name;
+    enum name_kind kind;
+    int type;
+    int value;
+};
+
+static inline uint32_t names_hash(uint32_t seed, const char *s) {
+    uint32_t hash = UINT32_C(2166136261) ^ seed * UINT32_C(0x9e3779b9);
+    while (*s)
+        hash = (hash ^ (unsigned char)*s++) * UINT32_C(16777619);
+    return hash;
+}
+
+int event_type_from_name(const char *name);
+int event_code_from_name(int type, const char *name);
+int property_from_name(const char *name);
+int bus_from_name(const char *name);
+const char *bus_get_name(int bus);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,908 @@
+#include <ctime>
+#include <atomic>
+#include <cerrno>
+#include <vector>
+#include <cstring>
+#include <climits>
+#include <algorithm>
+#include <stdexcept>
+
+extern "C" {
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+}
+
+#include <boost/interprocess/ipc/message_queue.hpp>
+
+#include "queue.hpp"
+
+using boost::interprocess::open_only;
+using boost::interprocess::create_only;
+using boost::interprocess::message_queue;
+
+namespace {
+
+const char ring_magic[8] = {'E', 'V', 'Q', 'R', 'I', 'N', 'G', '\0'};
+
+// bump whenever the layout changes, so that processes disagreeing on it fail
+constexpr uint32_t ring_version = 6;
+
+// leads every message queue message, so that bare input events from older
+// processes, or messages of another layout, are told apart
+constexpr uint32_t frame_magic = 0x31465645;  // "EVF1"
+
+constexpr int max_readers = 64;
+
+// Rings with priority lanes have one per kind of frame, taken in this order.
+enum { key_lane, other_lane, motion_lane, max_lanes };
+
+// A broadcast reader, attached while its pid is positive.
+struct ring_reader {
+    std::atomic<int32_t> pid;
+    std::atomic<uint64_t> cursor;
+};
+
+// Positions only ever grow, a cell's sequence telling which position it holds
+// and whether it's been published. In a ring the consumer hands cells back
+// through their sequence (Vyukov's bounded queue), in a broadcast ring each
+// reader has a cursor and producers stay a capacity ahead of the slowest one.
+// Each side has its own cache line.
+struct ring_lane {
+    alignas(64) std::atomic<uint64_t> enqueue_position;
+    alignas(64) std::atomic<uint64_t> dequeue_position;
+};
+
+// Lanes are rings of capacity cells each, following one another, the first
+// one being the only one of rings without priority lanes and broadcast rings.
+struct ring_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t type;
+    uint32_t capacity;
+    uint32_t policy;
+    uint32_t timeout;
+    uint32_t lanes;
+    uint32_t starvation;
+    ring_lane lane[max_lanes];
+    alignas(64) std::atomic<uint32_t> signal;
+    std::atomic<uint32_t> sleepers;
+    alignas(64) ring_reader readers[max_readers];
+    alignas(64) std::atomic<uint64_t> full, blocked, timed_out,
+        dropped_oldest, dropped_newest, coalesced;
+    // kept by producers and readers, the wait by readers in nanoseconds
+    alignas(64) std::atomic<uint64_t> high_water;
+    std::atomic<int64_t> max_wait;
+};
+
+// a frame per cell, along with when it was published
+struct ring_cell {
+    std::atomic<uint64_t> sequence;
+    int64_t published;
+    uint32_t count;
+    input_event events[event_queue::max_frame];
+};
+
+struct frame_message {
+    uint32_t magic;
+    uint32_t count;
+    input_event events[event_queue::max_frame];
+};
+
+std::string shm_path(const std::string &name) {
+    return name[0] == '/' ? name : '/' + name;
+}
+
+std::runtime_error system_error(const std::string &what) {
+    return std::runtime_error(what + ": " + std::strerror(errno));
+}
+
+void futex(std::atomic<uint32_t> &word, int op, uint32_t value,
+           const timespec *timeout = nullptr) {
+    syscall(SYS_futex, reinterpret_cast<uint32_t *>(&word), op, value, timeout,
+            nullptr, 0);
+}
+
+int64_t monotonic_now() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * INT64_C(1000000000) + ts.tv_nsec;
+}
+
+// Sleeps until one of the words in waiters changes or deadline passes, unless
+// negative, for up to a millisecond at a time when polling or where
+// futex_waitv isn't available.
+void futex_wait_any(std::vector<futex_waitv> &waiters, int64_t deadline,
+                    bool polling) {
+    int64_t now = monotonic_now(), tick = now + 1000000;
+    if ((polling || waiters.empty()) && (deadline < 0 || deadline > tick))
+        deadline = tick;
+    timespec ts = {time_t(deadline / 1000000000), long(deadline % 1000000000)};
+    if (!waiters.empty() &&
+        (syscall(SYS_futex_waitv, waiters.data(), waiters.size(), 0,
+                 deadline >= 0 ? &ts : nullptr, CLOCK_MONOTONIC) == 0 ||
+         errno != ENOSYS))
+        return;
+    if (deadline < 0 || deadline > tick)
+        deadline = tick;
+    ts = {0, long(deadline > now ? deadline - now : 0)};
+    nanosleep(&ts, nullptr);
+}
+
+bool is_frame_end(const input_event &event) {
+    return event.type == EV_SYN && event.code == SYN_REPORT;
+}
+
+// Frames that only move pointers or axes, which can be merged into one.
+bool is_motion(const input_event *events, size_t count) {
+    if (!count || !is_frame_end(events[count - 1]))
+        return false;
+    for (size_t i = 0; i < count; ++i)
+        if (!is_frame_end(events[i]) && events[i].type != EV_REL &&
+            (events[i].type != EV_ABS || events[i].code >= ABS_MT_SLOT) &&
+            (events[i].type != EV_MSC || events[i].code != MSC_TIMESTAMP))
+            return false;
+    return true;
+}
+
+// Lane of a frame in a ring with priority lanes: frames with key or button
+// events, those without motion, or the ones with nothing but motion and
+// sync or misc events. As for is_motion, multitouch axes aren't motion, as
+// touches would break if their frames were overtaken.
+unsigned int lane_of(const input_event *events, size_t count) {
+    bool motion = false, other = false;
+    for (size_t i = 0; i < count; ++i)
+        switch (events[i].type) {
+            case EV_KEY:
+                return key_lane;
+            case EV_ABS:
+                if (events[i].code >= ABS_MT_SLOT) {
+                    other = true;
+                    break;
+                }
+                motion = true;
+                break;
+            case EV_REL:
+                motion = true;
+                break;
+            case EV_SYN:
+            case EV_MSC:
+                break;
+            default:
+                other = true;
+        }
+    return motion && !other ? motion_lane : other_lane;
+}
+
+template <typename T>
+void store_max(std::atomic<T> &max, T value) {
+    T current = max.load(std::memory_order_relaxed);
+    while (value > current && !max.compare_exchange_weak(
+                                  current, value, std::memory_order_relaxed))
+        ;
+}
+
+// Merges a motion frame into another, adding up relative motion and keeping
+// the last value of everything else, unless the result wouldn't fit a cell.
+bool merge_motion(std::vector<input_event> &frame, const input_event *events,
+                  size_t count) {
+    std::vector<input_event> merged_frame(frame);
+    if (!merged_frame.empty())
+        merged_frame.pop_back();
+    for (size_t i = 0; i < count; ++i) {
+        auto merged = std::find_if(
+            merged_frame.begin(), merged_frame.end(),
+            [&](const input_event &event) {
+                return event.type == events[i].type &&
+                       event.code == events[i].code;
+            });
+        if (merged == merged_frame.end() || is_frame_end(events[i])) {
+            if (merged_frame.size() == event_queue::max_frame)
+                return false;
+            merged_frame.push_back(events[i]);
+            continue;
+        }
+        int value = events[i].type == EV_REL ? merged->value + events[i].value
+                                             : events[i].value;
+        *merged       = events[i];
+        merged->value = value;
+    }
+    frame.swap(merged_frame);
+    return true;
+}
+
+class shm_queue : public event_queue {
+    friend class event_queue;
+
+    void *map;
+    size_t size;
+
+protected:
+    ring_header *header;
+    ring_cell *cells;
+
+    std::vector<input_event> pending;
+
+    virtual bool try_push(unsigned int lane, const input_event *events,
+                          size_t count) = 0;
+    virtual bool try_drop(unsigned int lane) = 0;
+    virtual uint64_t room(unsigned int lane) = 0;
+    // frames that left the queue, read or dropped
+    virtual uint64_t drained() = 0;
+
+    // Keeps track of the backlog and the wait of a frame being read.
+    void record_read(int64_t published, uint64_t backlog) {
+        store_max(header->high_water, backlog);
+        store_max(header->max_wait, monotonic_now() - published);
+    }
+
+    // Wakes whoever sleeps on the ring, readers waiting for frames or
+    // producers waiting for room.
+    void wake() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (header->sleepers.load(std::memory_order_relaxed)) {
+            header->signal.fetch_add(1, std::memory_order_relaxed);
+            futex(header->signal, FUTEX_WAKE, INT_MAX);
+        }
+    }
+
+    // Waits for room for count frames, for up to the queue's timeout,
+    // sleeping on the ring's signal like readers do.
+    bool wait_room(unsigned int lane, size_t count) {
+        int64_t deadline = monotonic_now() + header->timeout * INT64_C(1000000);
+        while (room(lane) < count) {
+            int64_t now = monotonic_now();
+            if (now >= deadline)
+                return false;
+            uint32_t signal = header->signal.load(std::memory_order_acquire);
+            header->sleepers.fetch_add(1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (room(lane) < count) {
+                timespec ts = {time_t((deadline - now) / 1000000000),
+                               long((deadline - now) % 1000000000)};
+                futex(header->signal, FUTEX_WAIT, signal, &ts);
+            }
+            header->sleepers.fetch_sub(1, std::memory_order_relaxed);
+        }
+        return true;
+    }
+
+    // Pushes a frame that was found to fit, waiting in case other producers
+    // took the room meanwhile.
+    bool push(unsigned int lane, const input_event *events, size_t count) {
+        while (!try_push(lane, events, count))
+            if (!wait_room(lane, 1))
+                return false;
+        return true;
+    }
+
+    void publish(ring_cell &cell, uint64_t position, const input_event *events,
+                 size_t count) {
+        count          = count < max_frame ? count : max_frame;
+        cell.published = monotonic_now();
+        cell.count     = count;
+        std::copy(events, events + count, cell.events);
+        cell.sequence.store(position + 1, std::memory_order_release);
+        wake();
+    }
+
+    bool send_frame(unsigned int lane, const input_event *events,
+                    size_t count) {
+        unsigned int motion = header->lanes - 1;
+        size_t needed       = 1;
+        switch (header->policy) {
+            case fail:
+                if (room(lane) < 1) {
+                    ++header->full;
+                    return false;
+                }
+                return push(lane, events, count);
+            case block:
+                if (room(lane) < 1) {
+                    ++header->full;
+                    ++header->blocked;
+                    if (!wait_room(lane, 1)) {
+                        ++header->timed_out;
+                        return true;
+                    }
+                }
+                break;
+            case drop_oldest:
+                if (room(lane) >= 1)
+                    break;
+                ++header->full;
+                while (room(lane) < 1 && try_drop(lane))
+                    ++header->dropped_oldest;
+                break;
+            case drop_newest:
+                if (room(lane) < 1) {
+                    ++header->full;
+                    ++header->dropped_newest;
+                    return true;
+                }
+                break;
+            case coalesce:
+                // merged motion goes out ahead of frames of its lane, while
+                // frames of other lanes don't wait for it
+                needed += !pending.empty() && lane == motion;
+                if (room(lane) < needed) {
+                    ++header->full;
+                    if (is_motion(events, count) &&
+                        merge_motion(pending, events, count)) {
+                        ++header->coalesced;
+                        return true;
+                    }
+                    ++header->blocked;
+                    if (!wait_room(lane, needed)) {
+                        ++header->timed_out;
+                        return true;
+                    }
+                }
+                if (pending.empty() || (lane != motion && room(motion) < 1))
+                    break;
+                if (!push(motion, pending.data(), pending.size()))
+                    ++header->timed_out;
+                pending.clear();
+                break;
+        }
+
+        if (!push(lane, events, count))
+            ++header->timed_out;
+        return true;
+    }
+
+    // Pushes the merged motion before the queue goes away, waiting for room
+    // as long as a frame would. It's up to the destructors of the derived
+    // classes, as pushing goes through their try_push.
+    void push_pending() {
+        if (!pending.empty() &&
+            !push(header->lanes - 1, pending.data(), pending.size()))
+            ++header->timed_out;
+        pending.clear();
+    }
+
+public:
+    shm_queue(void *map, size_t size)
+        : map(map),
+          size(size),
+          header(static_cast<ring_header *>(map)),
+          cells(reinterpret_cast<ring_cell *>(header + 1)) {}
+
+    ~shm_queue() { munmap(map, size); }
+
+    statistics stats() override {
+        statistics stats = {};
+        stats.capacity   = uint64_t(header->lanes) * header->capacity;
+        for (unsigned int lane = 0; lane < header->lanes; ++lane)
+            stats.enqueued += header->lane[lane].enqueue_position.load(
+                std::memory_order_relaxed);
+        uint64_t drained     = this->drained();
+        stats.used           = stats.enqueued - drained;
+        stats.dropped_oldest = header->dropped_oldest;
+        stats.dequeued       = drained - stats.dropped_oldest;
+        stats.high_water     = header->high_water;
+        stats.full           = header->full;
+        stats.blocked        = header->blocked;
+        stats.timed_out      = header->timed_out;
+        stats.dropped_newest = header->dropped_newest;
+        stats.coalesced      = header->coalesced;
+        stats.max_wait_us    = header->max_wait / 1000;
+        return stats;
+    }
+
+    bool flush() override {
+        if (!pending.empty() &&
+            try_push(header->lanes - 1, pending.data(), pending.size()))
+            pending.clear();
+        return pending.empty();
+    }
+
+    // the lane is picked once, so that the parts of a long frame stay in order
+    bool send(const input_event *events, size_t count) override {
+        unsigned int lane = header->lanes > 1 ? lane_of(events, count) : 0;
+        for (; count > max_frame; events += max_frame, count -= max_frame)
+            if (!send_frame(lane, events, max_frame))
+                return false;
+        return send_frame(lane, events, count);
+    }
+
+    size_t receive(input_event *events) override {
+        size_t count;
+        while (!(count = try_receive(events))) {
+            uint32_t signal = header->signal.load(std::memory_order_acquire);
+            header->sleepers.fetch_add(1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            count = try_receive(events);
+            if (!count)
+                futex(header->signal, FUTEX_WAIT, signal);
+            header->sleepers.fetch_sub(1, std::memory_order_relaxed);
+            if (count)
+                break;
+        }
+        return count;
+    }
+};
+
+class ring_queue : public shm_queue {
+    // frames taken from higher lanes while each lane had some waiting
+    uint32_t starved[max_lanes] = {};
+
+    ring_cell *claim(unsigned int lane, std::atomic<uint64_t> &position_counter,
+                     uint64_t ready, uint64_t &position) {
+        ring_cell *lane_cells = &cells[lane * header->capacity];
+        position = position_counter.load(std::memory_order_relaxed);
+        for (;;) {
+            ring_cell *cell = &lane_cells[position % header->capacity];
+            int64_t lag = cell->sequence.load(std::memory_order_acquire) -
+                          (position + ready);
+            if (lag == 0 && position_counter.compare_exchange_weak(
+                                position, position + 1,
+                                std::memory_order_relaxed))
+                return cell;
+            if (lag < 0)
+                return nullptr;
+            if (lag > 0)
+                position = position_counter.load(std::memory_order_relaxed);
+        }
+    }
+
+    uint64_t used(unsigned int lane) {
+        return header->lane[lane].enqueue_position.load(
+                   std::memory_order_relaxed) -
+               header->lane[lane].dequeue_position.load(
+                   std::memory_order_relaxed);
+    }
+
+    size_t try_receive(unsigned int lane, input_event *events,
+                       bool dropping = false) {
+        uint64_t position;
+        ring_cell *cell =
+            claim(lane, header->lane[lane].dequeue_position, 1, position);
+        if (!cell)
+            return 0;
+
+        if (!dropping)
+            record_read(cell->published,
+                        header->lane[lane].enqueue_position.load(
+                            std::memory_order_relaxed) -
+                            position);
+        size_t count = cell->count < max_frame ? cell->count : max_frame;
+        std::copy(cell->events, cell->events + count, events);
+        cell->sequence.store(position + header->capacity,
+                             std::memory_order_release);
+        wake();
+        return count;
+    }
+
+    // Takes from the highest lane with frames, unless a lower one waited for
+    // starvation frames, the lowest of those going first then.
+    size_t try_receive(input_event *events) override {
+        unsigned int lanes = header->lanes, order[max_lanes], n = 0;
+        for (unsigned int lane = lanes; lane-- > 0;)
+            if (starved[lane] >= header->starvation)
+                order[n++] = lane;
+        for (unsigned int lane = 0; lane < lanes; ++lane)
+            if (starved[lane] < header->starvation)
+                order[n++] = lane;
+
+        for (unsigned int i = 0; i < lanes; ++i)
+            if (size_t count = try_receive(order[i], events)) {
+                starved[order[i]] = 0;
+                for (unsigned int lane = order[i] + 1; lane < lanes; ++lane)
+                    starved[lane] += used(lane) > 0;
+                return count;
+            }
+        return 0;
+    }
+
+    bool try_drop(unsigned int lane) override {
+        input_event events[max_frame];
+        return try_receive(lane, events, true);
+    }
+
+    uint64_t room(unsigned int lane) override {
+        uint64_t used = this->used(lane);
+        return used < header->capacity ? header->capacity - used : 0;
+    }
+
+    uint64_t drained() override {
+        uint64_t drained = 0;
+        for (unsigned int lane = 0; lane < header->lanes; ++lane)
+            drained += header->lane[lane].dequeue_position.load(
+                std::memory_order_relaxed);
+        return drained;
+    }
+
+    bool try_push(unsigned int lane, const input_event *events,
+                  size_t count) override {
+        uint64_t position;
+        ring_cell *cell =
+            claim(lane, header->lane[lane].enqueue_position, 0, position);
+        if (!cell)
+            return false;
+
+        publish(*cell, position, events, count);
+        // the backlog grows while readers stall, not only when they read
+        store_max(header->high_water, used(lane));
+        return true;
+    }
+
+public:
+    using shm_queue::shm_queue;
+
+    ~ring_queue() { push_pending(); }
+};
+
+class broadcast_queue : public shm_queue {
+    ring_reader *reader = nullptr;
+    uint64_t limit      = 0;
+
+    // Position of the slowest reader, reaping readers that died a capacity
+    // behind, so that they stop holding producers back.
+    uint64_t slowest(uint64_t position) {
+        uint64_t slowest = position;
+        for (auto &reader : header->readers) {
+            int32_t pid = reader.pid.load(std::memory_order_acquire);
+            if (pid <= 0)
+                continue;
+            uint64_t cursor = reader.cursor.load(std::memory_order_acquire);
+            if (position - cursor >= header->capacity && kill(pid, 0) < 0 &&
+                errno == ESRCH) {
+                reader.pid.compare_exchange_strong(pid, 0);
+                continue;
+            }
+            slowest = std::min(slowest, cursor);
+        }
+        return slowest;
+    }
+
+    // Claims a slot, publishing it with a cursor producers may have lapped
+    // already, and only then takes the cursor from where they are, so that
+    // from there on they can't lap it.
+    void attach() {
+        for (auto &reader : header->readers) {
+            int32_t pid = 0;
+            if (!reader.pid.compare_exchange_strong(pid, -1))
+                continue;
+            auto &position = header->lane[0].enqueue_position;
+            reader.cursor.store(position.load(std::memory_order_acquire),
+                                std::memory_order_relaxed);
+            reader.pid.store(getpid(), std::memory_order_seq_cst);
+            store_max(reader.cursor, position.load(std::memory_order_seq_cst));
+            this->reader = &reader;
+            return;
+        }
+        throw std::runtime_error("too many readers on broadcast queue");
+    }
+
+    size_t try_receive(input_event *events) override {
+        if (!reader)
+            attach();
+
+        // a producer dropping the frame moves the cursor on first, and then
+        // the copy is thrown away since the cell may have been reused
+        uint64_t cursor = reader->cursor.load(std::memory_order_acquire);
+        for (;;) {
+            ring_cell &cell = cells[cursor % header->capacity];
+            if (cell.sequence.load(std::memory_order_acquire) != cursor + 1)
+                return 0;
+            int64_t published = cell.published;
+            size_t count = cell.count < max_frame ? cell.count : max_frame;
+            std::copy(cell.events, cell.events + count, events);
+            if (!reader->cursor.compare_exchange_strong(
+                    cursor, cursor + 1, std::memory_order_acq_rel))
+                continue;
+            record_read(published, header->lane[0].enqueue_position.load(
+                                       std::memory_order_relaxed) -
+                                       cursor);
+            wake();
+            return count;
+        }
+    }
+
+    bool try_drop(unsigned int /*lane*/) override {
+        uint64_t position =
+            header->lane[0].enqueue_position.load(std::memory_order_acquire);
+        uint64_t oldest = slowest(position);
+        ring_cell &cell = cells[oldest % header->capacity];
+        if (oldest == position ||
+            cell.sequence.load(std::memory_order_acquire) != oldest + 1)
+            return false;
+
+        for (auto &reader : header->readers) {
+            uint64_t cursor = oldest;
+            if (reader.pid.load(std::memory_order_acquire) > 0)
+                reader.cursor.compare_exchange_strong(cursor, oldest + 1);
+        }
+        return true;
+    }
+
+    uint64_t room(unsigned int /*lane*/) override {
+        uint64_t position =
+            header->lane[0].enqueue_position.load(std::memory_order_relaxed);
+        return header->capacity - (position - slowest(position));
+    }
+
+    // as far as the slowest reader got
+    uint64_t drained() override {
+        return slowest(
+            header->lane[0].enqueue_position.load(std::memory_order_relaxed));
+    }
+
+    bool try_push(unsigned int /*lane*/, const input_event *events,
+                  size_t count) override {
+        uint64_t position =
+            header->lane[0].enqueue_position.load(std::memory_order_relaxed);
+        do {
+            if (position - limit >= header->capacity) {
+                limit = slowest(position);
+                if (position - limit >= header->capacity)
+                    return false;
+            }
+        } while (!header->lane[0].enqueue_position.compare_exchange_weak(
+            position, position + 1, std::memory_order_relaxed));
+
+        publish(cells[position % header->capacity], position, events, count);
+        store_max(header->high_water, position + 1 - slowest(position + 1));
+        return true;
+    }
+
+public:
+    using shm_queue::shm_queue;
+
+    ~broadcast_queue() {
+        push_pending();
+        if (reader)
+            reader->pid.store(0, std::memory_order_release);
+    }
+};
+
+class mq_queue : public event_queue {
+    message_queue queue;
+
+    static size_t unpack(const frame_message &message, size_t size,
+                         input_event *events) {
+        size_t header_size = sizeof message - sizeof message.events;
+        if (size < header_size || message.magic != frame_magic ||
+            message.count > max_frame ||
+            size != header_size + message.count * sizeof *events)
+            throw std::runtime_error(
+                "unexpected message layout while reading from input event "
+                "queue");
+        std::copy(message.events, message.events + message.count, events);
+        return message.count;
+    }
+
+public:
+    explicit mq_queue(const std::string &name)
+        : queue(open_only, name.c_str()) {
+        if (queue.get_max_msg_size() != sizeof(frame_message))
+            throw std::runtime_error("queue " + name +
+                                     " has an incompatible layout");
+    }
+
+    bool send(const input_event *events, size_t count) override {
+        frame_message message;
+        message.magic = frame_magic;
+        for (; count; events += message.count, count -= message.count) {
+            message.count = count < max_frame ? count : max_frame;
+            std::copy(events, events + message.count, message.events);
+            size_t size = sizeof message - sizeof message.events +
+                          message.count * sizeof *events;
+            if (!queue.try_send(&message, size, 0))
+                return false;
+        }
+        return true;
+    }
+
+    size_t receive(input_event *events) override {
+        frame_message message;
+        unsigned int priority;
+        message_queue::size_type size;
+        queue.receive(&message, sizeof message, size, priority);
+        return unpack(message, size, events);
+    }
+
+    size_t try_receive(input_event *events) override {
+        frame_message message;
+        unsigned int priority;
+        message_queue::size_type size;
+        if (!queue.try_receive(&message, sizeof message, size, priority))
+            return 0;
+        return unpack(message, size, events);
+    }
+
+    statistics stats() override {
+        statistics stats = {};
+        stats.capacity   = queue.get_max_msg();
+        stats.used       = queue.get_num_msg();
+        return stats;
+    }
+};
+
+}  // namespace
+
+bool event_queue::parse_type(const std::string &name, type &type) {
+    if (name == "ring")
+        type = ring;
+    else if (name == "broadcast")
+        type = broadcast;
+    else if (name == "mq")
+        type = mq;
+    else
+        return false;
+    return true;
+}
+
+bool event_queue::parse_policy(const std::string &spec, policy &policy,
+                               unsigned int &timeout) {
+    auto name = spec.substr(0, spec.find(':'));
+    if (name == "fail")
+        policy = fail;
+    else if (name == "block")
+        policy = block;
+    else if (name == "drop-oldest")
+        policy = drop_oldest;
+    else if (name == "drop-newest")
+        policy = drop_newest;
+    else if (name == "coalesce")
+        policy = coalesce;
+    else
+        return false;
+
+    timeout = 100;
+    if (name.size() == spec.size())
+        return true;
+    if (policy != block && policy != coalesce)
+        return false;
+    timeout = std::stoul(spec.substr(name.size() + 1));
+    return true;
+}
+
+void event_queue::create(const std::string &name, type type, size_t size,
+                         policy policy, unsigned int timeout,
+                         unsigned int starvation) {
+    remove(name);
+
+    if (starvation && type != ring)
+        throw std::runtime_error("only rings can have priority lanes");
+
+    if (type == mq) {
+        if (policy != fail)
+            throw std::runtime_error("message queues can only fail when full");
+        message_queue(create_only, name.c_str(), size, sizeof(frame_message),
+                      0600);
+        return;
+    }
+
+    if (size == 0 || size > UINT32_MAX)
+        throw std::runtime_error("invalid queue size");
+    size_t lanes    = starvation ? max_lanes : 1;
+    size_t map_size = sizeof(ring_header) + lanes * size * sizeof(ring_cell);
+
+    int fd = shm_open(shm_path(name).c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0)
+        throw system_error("shm_open failed");
+    void *map = MAP_FAILED;
+    if (ftruncate(fd, map_size) == 0)
+        map = mmap(nullptr, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+                   0);
+    close(fd);
+    if (map == MAP_FAILED)
+        throw system_error("error mapping queue");
+
+    auto header = new (map) ring_header();
+    header->version    = ring_version;
+    header->type       = type;
+    header->capacity   = size;
+    header->policy     = policy;
+    header->timeout    = timeout;
+    header->lanes      = lanes;
+    header->starvation = starvation;
+    auto cells         = reinterpret_cast<ring_cell *>(header + 1);
+    for (size_t i = 0; i < lanes * size; ++i)
+        new (&cells[i].sequence)
+            std::atomic<uint64_t>(type == ring ? i % size : 0);
+    std::atomic_thread_fence(std::memory_order_release);
+    std::memcpy(header->magic, ring_magic, sizeof ring_magic);
+    munmap(map, map_size);
+}
+
+void event_queue::remove(const std::string &name) {
+    message_queue::remove(name.c_str());
+}
+
+size_t event_queue::receive_any(
+    const std::vector<std::unique_ptr<event_queue>> &queues,
+    input_event *events, size_t &count, size_t &next, int timeout) {
+    int64_t deadline =
+        timeout < 0 ? -1 : monotonic_now() + timeout * INT64_C(1000000);
+    std::vector<shm_queue *> rings;
+    for (const auto &queue : queues)
+        if (auto ring = dynamic_cast<shm_queue *>(queue.get()))
+            rings.push_back(ring);
+    if (rings.size() > FUTEX_WAITV_MAX)
+        throw std::runtime_error("too many queues to wait on");
+    bool polling = rings.size() < queues.size();
+
+    // from the one after the last that had a frame
+    auto try_receive_any = [&]() {
+        for (size_t n = 0; n < queues.size(); ++n) {
+            size_t i = (next + n) % queues.size();
+            if ((count = queues[i]->try_receive(events))) {
+                next = i + 1;
+                return i;
+            }
+        }
+        return queues.size();
+    };
+
+    // same as shm_queue::receive, sleeping on every ring's signal at once
+    std::vector<futex_waitv> waiters(rings.size());
+    for (;;) {
+        size_t index = try_receive_any();
+        if (index < queues.size())
+            return index;
+        if (deadline >= 0 && monotonic_now() >= deadline)
+            return queues.size();
+
+        for (size_t i = 0; i < rings.size(); ++i) {
+            auto header      = rings[i]->header;
+            waiters[i]       = {};
+            waiters[i].val   = header->signal.load(std::memory_order_acquire);
+            waiters[i].uaddr = reinterpret_cast<uintptr_t>(&header->signal);
+            waiters[i].flags = FUTEX_32;
+            header->sleepers.fetch_add(1, std::memory_order_relaxed);
+        }
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        index = try_receive_any();
+        if (index == queues.size())
+            futex_wait_any(waiters, deadline, polling);
+        for (auto ring : rings)
+            ring->header->sleepers.fetch_sub(1, std::memory_order_relaxed);
+        if (index < queues.size())
+            return index;
+    }
+}
+
+std::unique_ptr<event_queue> event_queue::open(const std::string &name) {
+    int fd = shm_open(shm_path(name).c_str(), O_RDWR, 0);
+    if (fd < 0)
+        throw system_error("error opening queue " + name);
+    struct stat st;
+    void *map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size >= off_t(sizeof(ring_header)))
+        map = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+                   0);
+    close(fd);
+
+    auto header = static_cast<ring_header *>(map);
+    if (map == MAP_FAILED ||
+        std::memcmp(header->magic, ring_magic, sizeof ring_magic)) {
+        if (map != MAP_FAILED)
+            munmap(map, st.st_size);
+        return std::unique_ptr<event_queue>(new mq_queue(name));
+    }
+
+    size_t cells_size =
+        size_t(header->lanes) * header->capacity * sizeof(ring_cell);
+    if (header->version != ring_version ||
+        (header->type != ring && header->type != broadcast) ||
+        header->policy > coalesce ||
+        (header->lanes != 1 &&
+         (header->lanes != max_lanes || header->type != ring ||
+          !header->starvation)) ||
+        size_t(st.st_size) != sizeof(ring_header) + cells_size) {
+        munmap(map, st.st_size);
+        throw std::runtime_error("queue " + name +
+                                 " has an incompatible layout");
+    }
+    if (header->type == broadcast)
+        return std::unique_ptr<event_queue>(
+            new broadcast_queue(map, st.st_size));
+    return std::unique_ptr<event_queue>(new ring_queue(map, st.st_size));
+}
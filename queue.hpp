@@ -0,0 +1,81 @@
+#ifndef INTERCEPTION_QUEUE_HPP
+#define INTERCEPTION_QUEUE_HPP
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+#include <linux/input.h>
+
+// A named queue of input events shared between processes. Rings are lock-free
+// and only make a system call to wake a reader that went to sleep. Broadcast
+// rings are the same, except that every reader gets every event. Message
+// queues are boost's, taking an interprocess lock per message.
+//
+// Events travel a frame at a time, a frame (or each max_frame events of a
+// longer one) taking one message or ring cell. What happens to a frame that
+// doesn't fit is up to the policy the queue was created with: failing,
+// blocking for up to a timeout, dropping the oldest frames or the new one, or
+// merging motion frames into one while key frames wait for room. Rings count
+// how many frames each policy had to deal with.
+//
+// Rings can also have priority lanes, each as big as the queue, so that key
+// and button frames overtake anything else, and motion goes last. Frames keep
+// their order within a lane.
+class event_queue {
+public:
+    enum type { ring, broadcast, mq };
+    enum policy { fail, block, drop_oldest, drop_newest, coalesce };
+
+    // What a queue went through since it was created, counted in frames.
+    // Message queues only know how full they are.
+    struct statistics {
+        uint64_t capacity, used, enqueued, dequeued, high_water, full,
+            blocked, timed_out, dropped_oldest, dropped_newest, coalesced,
+            max_wait_us;
+    };
+
+    static constexpr size_t max_frame = 64;
+
+    virtual ~event_queue() {}
+    // returns false only when the frame doesn't fit and the policy is fail
+    virtual bool send(const input_event *events, size_t count) = 0;
+    // blocks for a frame, filling up to max_frame events and returning their
+    // count
+    virtual size_t receive(input_event *events) = 0;
+    // like receive, but returns 0 instead of blocking
+    virtual size_t try_receive(input_event *events) = 0;
+    // sends what the policy held back if it fits by now, returning false
+    // while something is still held back
+    virtual bool flush() { return true; }
+    // reads the counters of the queue without taking part in the stream
+    virtual statistics stats() = 0;
+
+    // Blocks for a frame on any of queues, filling events and count like
+    // receive and returning the index of the queue it came from, or the
+    // number of queues after timeout ms unless negative. Rings are waited on
+    // all at once, message queues polled every millisecond. Queues are tried
+    // round robin from next, which the caller keeps across calls on the same
+    // queues, so that a busy queue doesn't starve the others.
+    static size_t receive_any(
+        const std::vector<std::unique_ptr<event_queue>> &queues,
+        input_event *events, size_t &count, size_t &next, int timeout = -1);
+
+    // Parse the names mux takes for types, and for policies followed by an
+    // optional :ms timeout, returning false for unknown ones.
+    static bool parse_type(const std::string &name, type &type);
+    static bool parse_policy(const std::string &spec, policy &policy,
+                             unsigned int &timeout);
+
+    // starvation, unless 0, gives a ring priority lanes, a lower lane waiting
+    // for at most that many frames of higher ones
+    static void create(const std::string &name, type type, size_t size,
+                       policy policy = fail, unsigned int timeout = 0,
+                       unsigned int starvation = 0);
+    static void remove(const std::string &name);
+    static std::unique_ptr<event_queue> open(const std::string &name);
+};
+
+#endif
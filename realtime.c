@@ -0,0 +1,128 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sched.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+
+#include "realtime.h"
+
+#define LONG_BITS (8 * sizeof(unsigned long))
+#define DEFAULT_PRIORITY 10
+#define STACK_PREFAULT (256 * 1024)
+#define THREAD_STACK (512 * 1024)
+
+static int parse_cpus(struct realtime *rt, const char *list) {
+    for (const char *p = list; *p;) {
+        char *end;
+        long first = strtol(p, &end, 10), last = first;
+        if (end == p)
+            return -1;
+        if (*end == '-') {
+            p    = end + 1;
+            last = strtol(p, &end, 10);
+            if (end == p)
+                return -1;
+        }
+        if (first < 0 || last < first || last >= REALTIME_MAX_CPUS)
+            return -1;
+        for (long cpu = first; cpu <= last; ++cpu)
+            rt->cpus[cpu / LONG_BITS] |= 1UL << (cpu % LONG_BITS);
+        if (*end == ',')
+            ++end;
+        else if (*end)
+            return -1;
+        p = end;
+    }
+
+    rt->has_cpus = 1;
+
+    return 0;
+}
+
+// Parses [fifo|rr][:priority][@cpulist], as in "rr:20@2,4-5", an empty or
+// missing spec meaning SCHED_FIFO at the default priority on any CPU.
+int realtime_parse(struct realtime *rt, const char *spec) {
+    memset(rt, 0, sizeof *rt);
+    rt->enabled  = 1;
+    rt->policy   = SCHED_FIFO;
+    rt->priority = DEFAULT_PRIORITY;
+
+    if (!spec)
+        return 0;
+
+    size_t policy_length = strcspn(spec, ":@");
+    if (policy_length == 2 && !strncmp(spec, "rr", 2))
+        rt->policy = SCHED_RR;
+    else if (policy_length && (policy_length != 4 || strncmp(spec, "fifo", 4)))
+        return -1;
+    spec += policy_length;
+
+    if (*spec == ':') {
+        char *end;
+        rt->priority = strtol(++spec, &end, 10);
+        if (end == spec || rt->priority < sched_get_priority_min(rt->policy) ||
+            rt->priority > sched_get_priority_max(rt->policy))
+            return -1;
+        spec = end;
+    }
+
+    if (*spec == '@')
+        return parse_cpus(rt, spec + 1);
+
+    return *spec ? -1 : 0;
+}
+
+static void prefault_stack(void) {
+    volatile char stack[STACK_PREFAULT];
+    for (size_t i = 0; i < sizeof stack; i += 4096)
+        stack[i] = 0;
+}
+
+// Switches the process to the requested realtime profile: pinned to its CPUs,
+// with every page it has or will have locked and faulted in beforehand, and
+// scheduled ahead of all regular tasks. Threads started afterwards get small
+// stacks, so that locking doesn't pin the default 8MB of each. Whatever the
+// kernel refuses is reported, and the rest applies regardless, with a nice
+// level of -20 standing in for realtime scheduling.
+void realtime_apply(const struct realtime *rt) {
+    if (!rt->enabled)
+        return;
+
+    if (rt->has_cpus) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        for (int cpu = 0; cpu < REALTIME_MAX_CPUS && cpu < CPU_SETSIZE; ++cpu)
+            if (rt->cpus[cpu / LONG_BITS] & 1UL << (cpu % LONG_BITS))
+                CPU_SET(cpu, &cpus);
+        if (sched_setaffinity(0, sizeof cpus, &cpus) < 0)
+            perror("sched_setaffinity failed, not pinning to CPUs");
+    }
+
+    // keep freed heap memory around instead of having to fault it in again
+    mallopt(M_TRIM_THRESHOLD, -1);
+    mallopt(M_MMAP_MAX, 0);
+    pthread_attr_t attr;
+    if (pthread_attr_init(&attr) == 0) {
+        if ((errno = pthread_attr_setstacksize(&attr, THREAD_STACK)) ||
+            (errno = pthread_setattr_default_np(&attr)))
+            perror("pthread_setattr_default_np failed, not shrinking stacks");
+        pthread_attr_destroy(&attr);
+    }
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0)
+        perror("mlockall failed, not locking memory");
+    prefault_stack();
+
+    struct sched_param param = {.sched_priority = rt->priority};
+    if (sched_setscheduler(0, rt->policy, &param) < 0) {
+        perror("sched_setscheduler failed, falling back to nice -20");
+        if (setpriority(PRIO_PROCESS, 0, -20) < 0)
+            perror("setpriority failed");
+    }
+}
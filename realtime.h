@@ -0,0 +1,32 @@
+#ifndef INTERCEPTION_REALTIME_H
+#define INTERCEPTION_REALTIME_H
+
+#include <getopt.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// getopt_long value of the --rt option shared by the tools
+#define REALTIME_OPTION 0x100
+#define REALTIME_LONG_OPTION                                                   \
+    { "rt", optional_argument, NULL, REALTIME_OPTION }
+
+#define REALTIME_MAX_CPUS 1024
+
+struct realtime {
+    int enabled;
+    int policy;
+    int priority;
+    int has_cpus;
+    unsigned long cpus[REALTIME_MAX_CPUS / (8 * sizeof(unsigned long))];
+};
+
+int realtime_parse(struct realtime *rt, const char *spec);
+void realtime_apply(const struct realtime *rt);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
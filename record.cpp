@@ -0,0 +1,171 @@
+#include <cstdio>
+#include <vector>
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <stdexcept>
+
+extern "C" {
+#include <fcntl.h>
+#include <unistd.h>
+}
+
+#include <libevdev/libevdev.h>
+
+#include "capture.h"
+#include "device.hpp"
+
+void print_usage(std::FILE *stream, const char *program) {
+    // clang-format off
+    std::fprintf(stream,
+                 "record - record device input events to a capture file\n"
+                 "\n"
+                 "usage: %s [-h | [-g | -s] devnode capture]\n"
+                 "\n"
+                 "options:\n"
+                 "    -h        show this message and exit\n"
+                 "    -g        grab device\n"
+                 "    -s        record events read from stdin instead, the device\n"
+                 "              only being described\n"
+                 "    devnode   path of device to record\n"
+                 "    capture   path of capture file to write\n",
+                 program);
+    // clang-format on
+}
+
+volatile std::sig_atomic_t stopped = 0;
+
+void stop(int) { stopped = 1; }
+
+int main(int argc, char *argv[]) try {
+    using std::perror;
+
+    bool grab = false, from_stdin = false;
+
+    for (int opt; (opt = getopt(argc, argv, "hgs")) != -1;) {
+        switch (opt) {
+            case 'h':
+                return print_usage(stdout, argv[0]), EXIT_SUCCESS;
+            case 'g':
+                if (grab || from_stdin)
+                    break;
+                grab = true;
+                continue;
+            case 's':
+                if (grab || from_stdin)
+                    break;
+                from_stdin = true;
+                continue;
+        }
+
+        return print_usage(stderr, argv[0]), EXIT_FAILURE;
+    }
+
+    if (argc - optind != 2)
+        return print_usage(stderr, argv[0]), EXIT_FAILURE;
+
+    int fd = open(argv[optind], O_RDONLY);
+    if (fd < 0)
+        return perror("open failed"), EXIT_FAILURE;
+    struct defer1 {
+        int fd;
+        ~defer1() { close(fd); }
+    } defer1{fd};
+    libevdev *dev;
+    if (libevdev_new_from_fd(fd, &dev) < 0)
+        return perror("libevdev_new_from_fd failed"), EXIT_FAILURE;
+    struct defer2 {
+        libevdev *dev;
+        ~defer2() { libevdev_free(dev); }
+    } defer2{dev};
+
+    int capture = open(argv[optind + 1], O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (capture < 0)
+        return perror("open failed"), EXIT_FAILURE;
+    struct defer3 {
+        int fd;
+        ~defer3() { close(fd); }
+    } defer3{capture};
+    if (capture_write_header(capture, yaml_create_from_evdev(dev).c_str()) < 0)
+        return perror("error writing capture header"), EXIT_FAILURE;
+
+    // interrupt the blocking reads, so that the index still gets written
+    struct sigaction action = {};
+    action.sa_handler       = stop;
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+    sigaction(SIGHUP, &action, nullptr);
+
+    if (grab && libevdev_grab(dev, LIBEVDEV_GRAB) < 0)
+        return perror("libevdev_grab failed"), EXIT_FAILURE;
+
+    // each frame is written as soon as it's complete, so that a capture that
+    // is cut short only misses its index
+    std::vector<capture_event> frame;
+    std::vector<capture_frame> frames;
+    uint64_t event_count = 0;
+    auto flush           = [&]() {
+        size_t size = frame.size() * sizeof frame[0];
+        for (size_t offset = 0; offset < size;) {
+            ssize_t written = write(
+                capture, reinterpret_cast<char *>(frame.data()) + offset,
+                size - offset);
+            if (written < 0 && errno != EINTR)
+                throw std::runtime_error("error writing capture events");
+            offset += written < 0 ? 0 : written;
+        }
+        event_count += frame.size();
+        frame.clear();
+    };
+    auto record = [&](const input_event &input) {
+        int64_t time = input.input_event_sec * INT64_C(1000000) +
+                       input.input_event_usec;
+        frame.push_back({time, input.type, input.code, input.value});
+        if (input.type == EV_SYN && input.code == SYN_REPORT) {
+            frames.push_back({time, event_count});
+            flush();
+        }
+    };
+
+    input_event input;
+    if (from_stdin) {
+        std::setbuf(stdin, nullptr);
+        while (!stopped && std::fread(&input, sizeof input, 1, stdin) == 1)
+            record(input);
+    } else {
+        while (!stopped) {
+            int rc = libevdev_next_event(
+                dev, LIBEVDEV_READ_FLAG_NORMAL | LIBEVDEV_READ_FLAG_BLOCKING,
+                &input);
+
+            while (rc == LIBEVDEV_READ_STATUS_SYNC)
+                rc = libevdev_next_event(dev, LIBEVDEV_READ_FLAG_SYNC, &input);
+
+            if (rc == -EAGAIN || rc == -EINTR)
+                continue;
+
+            if (rc != LIBEVDEV_READ_STATUS_SUCCESS)
+                break;
+
+            record(input);
+        }
+    }
+
+    flush();
+    // piped events needn't come in time order, while the index is searched by
+    // time
+    std::stable_sort(frames.begin(), frames.end(),
+                     [](const capture_frame &a, const capture_frame &b) {
+                         return a.time < b.time;
+                     });
+    if (capture_write_index(capture, event_count, frames.data(),
+                            frames.size()) < 0)
+        return perror("error writing capture index"), EXIT_FAILURE;
+} catch (const std::exception &e) {
+    return std::fprintf(stderr,
+                        R"(an exception occurred: "%s")"
+                        "\n",
+                        e.what()),
+           EXIT_FAILURE;
+}
@@ -0,0 +1,117 @@
+#include <ctime>
+
+#include "state.hpp"
+
+namespace {
+
+// Time spent suspended since boot, as CLOCK_MONOTONIC doesn't count it.
+int64_t suspend_time() {
+    timespec boottime, monotonic;
+    clock_gettime(CLOCK_BOOTTIME, &boottime);
+    clock_gettime(CLOCK_MONOTONIC, &monotonic);
+    return (boottime.tv_sec - monotonic.tv_sec) * INT64_C(1000000000) +
+           boottime.tv_nsec - monotonic.tv_nsec;
+}
+
+}  // namespace
+
+device_state::device_state(const libevdev *dev) : suspended(suspend_time()) {
+    for (int code = 0; code <= ABS_MAX; ++code) {
+        auto absinfo = libevdev_get_abs_info(dev, code);
+        exact[code] = absinfo && absinfo->fuzz == 0;
+    }
+
+    if (auto absinfo = libevdev_get_abs_info(dev, ABS_MT_SLOT)) {
+        slots = absinfo->maximum + 1;
+        mt_values.resize(slots * mt_axes);
+        mt_known.resize(slots * mt_axes);
+    }
+}
+
+bool device_state::changes(const input_event &event) {
+    switch (event.type) {
+        case EV_SYN:
+            return event.code != SYN_REPORT || pending;
+        case EV_KEY:
+            if (event.code >= KEY_CNT || event.value == 2)
+                return true;
+            if (keys[event.code] == !!event.value)
+                return false;
+            keys[event.code] = !!event.value;
+            return true;
+        case EV_SW:
+            if (event.code >= SW_CNT)
+                return true;
+            if (switches[event.code] == !!event.value)
+                return false;
+            switches[event.code] = !!event.value;
+            return true;
+        case EV_REL:
+            return event.value != 0;
+        case EV_ABS: {
+            if (event.code >= ABS_CNT)
+                return true;
+            if (event.code == ABS_MT_SLOT && slots) {
+                if (event.value < 0 || event.value >= slots)
+                    return true;
+                if (slot == event.value)
+                    return false;
+                slot = event.value;
+                return true;
+            }
+            if (!exact[event.code])
+                return true;
+
+            int *value;
+            bool known;
+            if (event.code >= ABS_MT_TOUCH_MAJOR &&
+                event.code <= ABS_MT_TOOL_Y) {
+                if (!slots || slot < 0)
+                    return true;
+                size_t i = slot * mt_axes + event.code - ABS_MT_TOUCH_MAJOR;
+                value    = &mt_values[i];
+                known    = mt_known[i];
+                mt_known[i] = true;
+            } else {
+                value = &values[event.code];
+                known = this->known[event.code];
+                this->known[event.code] = true;
+            }
+            if (known && *value == event.value)
+                return false;
+            *value = event.value;
+            return true;
+        }
+        default:
+            return true;
+    }
+}
+
+// The two clocks are read apart, so their difference wanders a bit without
+// any suspend having happened.
+bool device_state::resumed() {
+    int64_t now = suspend_time();
+    if (now - suspended < 1000000)
+        return false;
+    suspended = now;
+    return true;
+}
+
+size_t device_state::filter(const input_event *events, size_t count,
+                            input_event *out) {
+    // input_reset_device releases every key when the system resumes
+    if (resumed())
+        keys.reset();
+
+    size_t kept = 0;
+    for (size_t i = 0; i < count; ++i) {
+        if (!changes(events[i]))
+            continue;
+        out[kept++] = events[i];
+        pending = events[i].type == EV_SYN && events[i].code == SYN_REPORT
+                      ? 0
+                      : pending + 1;
+    }
+
+    return kept;
+}
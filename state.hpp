@@ -0,0 +1,41 @@
+#ifndef INTERCEPTION_STATE_HPP
+#define INTERCEPTION_STATE_HPP
+
+#include <bitset>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+#include <libevdev/libevdev.h>
+
+// The part of the state the kernel keeps for a virtual device that tells
+// which events it would discard on arrival: key and switch states, values of
+// axes without fuzz, per slot for multitouch ones, and the current slot. Only
+// what was written through filter is known, so nothing else gets discarded.
+// Keys are taken as released after a system suspend, as the kernel releases
+// them on resume.
+class device_state {
+    static constexpr int mt_axes = ABS_MT_TOOL_Y - ABS_MT_TOUCH_MAJOR + 1;
+
+    std::bitset<KEY_CNT> keys;
+    std::bitset<SW_CNT> switches;
+    std::bitset<ABS_CNT> exact, known;
+    int values[ABS_CNT] = {};
+    int slots = 0, slot = -1;
+    std::vector<int> mt_values;
+    std::vector<bool> mt_known;
+    size_t pending = 0;
+    int64_t suspended;
+
+    bool changes(const input_event &event);
+    bool resumed();
+
+public:
+    explicit device_state(const libevdev *dev);
+
+    // Copies to out the events that make a difference to the device, leaving
+    // out in particular frames that are left empty, and returns their count.
+    size_t filter(const input_event *events, size_t count, input_event *out);
+};
+
+#endif
@@ -0,0 +1,16 @@
+#ifndef INTERCEPTION_STREAM_H
+#define INTERCEPTION_STREAM_H
+
+#include <stdint.h>
+
+#include <linux/input.h>
+
+// Record written by `intercept -T` in place of a bare input_event, carrying
+// the index of the device the event comes from.
+struct tagged_input_event {
+    uint32_t tag;
+    uint32_t reserved;
+    struct input_event event;
+};
+
+#endif
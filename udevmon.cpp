@@ -27,6 +27,8 @@ extern "C" {
 
 #include <yaml-cpp/yaml.h>
 
+#include "names.h"
+
 using yaml = std::vector<YAML::Node>;
 
 void print_usage(std::FILE *stream, const char *program) {
@@ -211,10 +213,10 @@ struct job {
 
                 vector<int> properties;
                 for (const auto &property_name : property_names) {
-                    int property = is_int(property_name)
-                                       ? stoi(property_name)
-                                       : libevdev_property_from_name(
-                                             property_name.c_str());
+                    int property =
+                        is_int(property_name)
+                            ? stoi(property_name)
+                            : property_from_name(property_name.c_str());
                     if (property < 0)
                         throw invalid_argument("invalid EVENT CODE: " +
                                                property_name);
@@ -229,8 +231,8 @@ struct job {
                 auto event_type_name = event.first.as<string>();
                 int event_type       = is_int(event_type_name)
                                            ? stoi(event_type_name)
-                                           : libevdev_event_type_from_name(
-                                           event_type_name.c_str());
+                                           : event_type_from_name(
+                                                 event_type_name.c_str());
                 if (event_type < 0)
                     throw invalid_argument("invalid EVENT TYPE: " +
                                            event_type_name);
@@ -248,7 +250,7 @@ struct job {
                         int event_code =
                             is_int(event_code_name)
                                 ? stoi(event_code_name)
-                                : libevdev_event_code_from_name(
+                                : event_code_from_name(
                                       event_type, event_code_name.c_str());
                         if (event_code < 0)
                             throw invalid_argument("invalid EVENT CODE: " +
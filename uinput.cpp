@@ -1,526 +1,753 @@
 #include <map>
+#include <list>
+#include <ctime>
+#include <mutex>
+#include <bitset>
+#include <memory>
+#include <cerrno>
 #include <cstdio>
 #include <string>
+#include <thread>
 #include <vector>
+#include <utility>
 #include <cstdlib>
+#include <cstring>
+#include <cinttypes>
 #include <algorithm>
 #include <stdexcept>
 
 extern "C" {
+#include <poll.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
 }
 
 #include <yaml-cpp/yaml.h>
 #include <libevdev/libevdev-uinput.h>
 
-std::map<int, std::string> bus_string = {
-#ifdef BUS_PCI
-    {BUS_PCI, "BUS_PCI"},
-#endif
-#ifdef BUS_ISAPNP
-    {BUS_ISAPNP, "BUS_ISAPNP"},
-#endif
-#ifdef BUS_USB
-    {BUS_USB, "BUS_USB"},
-#endif
-#ifdef BUS_HIL
-    {BUS_HIL, "BUS_HIL"},
-#endif
-#ifdef BUS_BLUETOOTH
-    {BUS_BLUETOOTH, "BUS_BLUETOOTH"},
-#endif
-#ifdef BUS_VIRTUAL
-    {BUS_VIRTUAL, "BUS_VIRTUAL"},
-#endif
-#ifdef BUS_ISA
-    {BUS_ISA, "BUS_ISA"},
-#endif
-#ifdef BUS_I8042
-    {BUS_I8042, "BUS_I8042"},
-#endif
-#ifdef BUS_XTKBD
-    {BUS_XTKBD, "BUS_XTKBD"},
-#endif
-#ifdef BUS_RS232
-    {BUS_RS232, "BUS_RS232"},
-#endif
-#ifdef BUS_GAMEPORT
-    {BUS_GAMEPORT, "BUS_GAMEPORT"},
-#endif
-#ifdef BUS_PARPORT
-    {BUS_PARPORT, "BUS_PARPORT"},
-#endif
-#ifdef BUS_AMIGA
-    {BUS_AMIGA, "BUS_AMIGA"},
-#endif
-#ifdef BUS_ADB
-    {BUS_ADB, "BUS_ADB"},
-#endif
-#ifdef BUS_I2C
-    {BUS_I2C, "BUS_I2C"},
-#endif
-#ifdef BUS_HOST
-    {BUS_HOST, "BUS_HOST"},
-#endif
-#ifdef BUS_GSC
-    {BUS_GSC, "BUS_GSC"},
-#endif
-#ifdef BUS_ATARI
-    {BUS_ATARI, "BUS_ATARI"},
-#endif
-#ifdef BUS_SPI
-    {BUS_SPI, "BUS_SPI"},
-#endif
-#ifdef BUS_RMI
-    {BUS_RMI, "BUS_RMI"},
-#endif
-#ifdef BUS_CEC
-    {BUS_CEC, "BUS_CEC"},
-#endif
-#ifdef BUS_INTEL_ISHTP
-    {BUS_INTEL_ISHTP, "BUS_INTEL_ISHTP"},
-#endif
-};
-
-std::map<std::string, int> string_bus = {
-#ifdef BUS_PCI
-    {"BUS_PCI", BUS_PCI},
-#endif
-#ifdef BUS_ISAPNP
-    {"BUS_ISAPNP", BUS_ISAPNP},
-#endif
-#ifdef BUS_USB
-    {"BUS_USB", BUS_USB},
-#endif
-#ifdef BUS_HIL
-    {"BUS_HIL", BUS_HIL},
-#endif
-#ifdef BUS_BLUETOOTH
-    {"BUS_BLUETOOTH", BUS_BLUETOOTH},
-#endif
-#ifdef BUS_VIRTUAL
-    {"BUS_VIRTUAL", BUS_VIRTUAL},
-#endif
-#ifdef BUS_ISA
-    {"BUS_ISA", BUS_ISA},
-#endif
-#ifdef BUS_I8042
-    {"BUS_I8042", BUS_I8042},
-#endif
-#ifdef BUS_XTKBD
-    {"BUS_XTKBD", BUS_XTKBD},
-#endif
-#ifdef BUS_RS232
-    {"BUS_RS232", BUS_RS232},
-#endif
-#ifdef BUS_GAMEPORT
-    {"BUS_GAMEPORT", BUS_GAMEPORT},
-#endif
-#ifdef BUS_PARPORT
-    {"BUS_PARPORT", BUS_PARPORT},
-#endif
-#ifdef BUS_AMIGA
-    {"BUS_AMIGA", BUS_AMIGA},
-#endif
-#ifdef BUS_ADB
-    {"BUS_ADB", BUS_ADB},
-#endif
-#ifdef BUS_I2C
-    {"BUS_I2C", BUS_I2C},
-#endif
-#ifdef BUS_HOST
-    {"BUS_HOST", BUS_HOST},
-#endif
-#ifdef BUS_GSC
-    {"BUS_GSC", BUS_GSC},
-#endif
-#ifdef BUS_ATARI
-    {"BUS_ATARI", BUS_ATARI},
-#endif
-#ifdef BUS_SPI
-    {"BUS_SPI", BUS_SPI},
-#endif
-#ifdef BUS_RMI
-    {"BUS_RMI", BUS_RMI},
-#endif
-#ifdef BUS_CEC
-    {"BUS_CEC", BUS_CEC},
-#endif
-#ifdef BUS_INTEL_ISHTP
-    {"BUS_INTEL_ISHTP", BUS_INTEL_ISHTP},
-#endif
-};
+#include "cache.hpp"
+#include "capture.h"
+#include "device.hpp"
+#include "latency.h"
+#include "realtime.h"
+#include "state.hpp"
+#include "stream.h"
 
 void print_usage(std::FILE *stream, const char *program) {
     // clang-format off
     std::fprintf(stream,
                  "uinput - redirect device input events from stdin to virtual device\n"
                  "\n"
-                 "usage: %s [-h | [-p] [-c device.yaml] [-d devnode]]\n"
+                 "usage: %s [-h | -a socket | [-p] [-L] [--rt[=spec]]\n"
+                 "              [-r | -R capture [-f] [-t ms] | -l socket] [-C cachedir]\n"
+                 "              [-s tag] [-c device.yaml] [-d devnode]]\n"
                  "\n"
                  "options:\n"
                  "    -h                show this message and exit\n"
                  "    -p                show resulting YAML device description merge and exit\n"
+                 "    -L                measure the age of written events, see intercept -m,\n"
+                 "                      dumping percentiles on SIGUSR1 and exit\n"
+                 "    -C cachedir       keep compiled device descriptions in cachedir, keyed\n"
+                 "                      by what they are merged from, for faster startup\n"
                  "    -c device.yaml    merge YAML device description to resulting virtual\n"
                  "                      device (repeatable)\n"
                  "    -d devnode        merge reference device description to resulting virtual\n"
-                 "                      device (repeatable)\n",
+                 "                      device (repeatable)\n"
+                 "    -s tag            have the -c and -d options that follow describe the\n"
+                 "                      virtual device for records of tag in a tagged stream,\n"
+                 "                      see intercept -T (repeatable)\n"
+                 "    -r                pace events from stdin by their timestamps\n"
+                 "    -R capture        replay capture file instead of stdin at its original\n"
+                 "                      pace, describing the device unless -c or -d is given\n"
+                 "    -f                replay capture as fast as possible\n"
+                 "    -t ms             start replay with the first frame ms after the\n"
+                 "                      start of the capture\n"
+                 "    -l socket         keep the virtual device alive, having writers attach\n"
+                 "                      through socket instead of reading stdin\n"
+                 "    -a socket         attach to uinput listening on socket, writing stdin\n"
+                 "                      to its virtual device\n"
+                 "    --rt[=spec]       run realtime with locked memory, spec being\n"
+                 "                      [fifo|rr][:prio][@cpulist] (default: fifo:10)\n",
                  program);
     // clang-format on
 }
 
-bool is_int(const std::string &s) {
-    return s.find_first_not_of("0123456789") == std::string::npos;
+int64_t monotonic_now() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * INT64_C(1000000000) + ts.tv_nsec;
 }
 
-using block_type = unsigned long;
+// Holds frames back until as much time has passed since the first one as
+// between their timestamps. Sleeps end short of the deadline and the rest is
+// spun, since wakeups from clock_nanosleep lag by tens of microseconds.
+class pacer {
+    static constexpr int64_t spin_tail = 100000;
+
+    bool started = false;
+    int64_t origin, last, start;
+
+public:
+    void wait(int64_t usec) {
+        int64_t now = monotonic_now();
+        if (!started || usec < last) {
+            started = true;
+            origin  = last = usec;
+            start   = now;
+            return;
+        }
+        last = usec;
+
+        int64_t deadline = start + (usec - origin) * 1000;
+        if (deadline - spin_tail > now) {
+            timespec ts = {
+                static_cast<time_t>((deadline - spin_tail) / 1000000000),
+                static_cast<long>((deadline - spin_tail) % 1000000000)};
+            while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts,
+                                   nullptr) == EINTR)
+                ;
+        }
+        while (monotonic_now() < deadline)
+            ;
+    }
+};
+
+bool write_all(int fd, const void *data, size_t size) {
+    for (auto p = static_cast<const char *>(data); size;) {
+        ssize_t written = write(fd, p, size);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        p += written;
+        size -= written;
+    }
 
-constexpr int block_size = sizeof(block_type) * 8;
+    return true;
+}
 
-constexpr int blocks_needed(int n_bits) {
-    return (n_bits - 1) / block_size + 1;
+bool is_frame_end(const input_event &event) {
+    return event.type == EV_SYN && event.code == SYN_REPORT;
 }
 
-bool bit(const block_type buffer[], int bit_index) {
-    return buffer[bit_index / block_size] &
-           (block_type{1} << (bit_index % block_size));
+// Reads events from fd in bulk and hands them to emit a whole frame at a
+// time, so that each frame reaches the virtual device in a single write. A
+// frame that stays incomplete for partial_frame_timeout since it started, or
+// that outgrows the buffer, is handed over as far as it goes.
+template <typename F>
+bool read_frames(int fd, F emit) {
+    constexpr int64_t partial_frame_timeout = INT64_C(10000000);
+    constexpr size_t capacity               = 1024;
+
+    input_event buffer[capacity];
+    auto bytes = reinterpret_cast<char *>(buffer);
+    size_t filled = 0, scanned = 0, first = 0;
+    int64_t deadline = 0;
+
+    for (;;) {
+        if (scanned > first) {
+            int64_t now = monotonic_now();
+            if (now >= deadline) {
+                if (!emit(buffer + first, scanned - first))
+                    return false;
+                first = scanned;
+            } else {
+                pollfd pfd = {fd, POLLIN, 0};
+                int rc =
+                    poll(&pfd, 1, int((deadline - now + 999999) / 1000000));
+                if (rc < 0 && errno != EINTR)
+                    return false;
+                if (rc <= 0)
+                    continue;
+            }
+        }
+
+        ssize_t n = read(fd, bytes + filled, sizeof buffer - filled);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        if (n == 0)
+            return scanned == first || emit(buffer + first, scanned - first);
+        filled += n;
+
+        bool partial = scanned > first;
+        for (; (scanned + 1) * sizeof *buffer <= filled; ++scanned)
+            if (is_frame_end(buffer[scanned])) {
+                if (!emit(buffer + first, scanned + 1 - first))
+                    return false;
+                first   = scanned + 1;
+                partial = false;
+            }
+        if (!partial && scanned > first)
+            deadline = monotonic_now() + partial_frame_timeout;
+
+        if (first == 0 && filled == sizeof buffer) {
+            if (!emit(buffer, scanned))
+                return false;
+            first = scanned;
+        }
+
+        std::memmove(bytes, bytes + first * sizeof *buffer,
+                     filled - first * sizeof *buffer);
+        filled -= first * sizeof *buffer;
+        scanned -= first;
+        first = 0;
+    }
 }
 
-std::string yaml_create_from_evdev(libevdev *dev) {
-    using std::map;
-    using std::vector;
-    using std::string;
-    using std::any_of;
-
-    YAML::Emitter yaml;
-    yaml << YAML::BeginMap;
-
-    if (auto name = libevdev_get_name(dev))
-        yaml << YAML::Key << "NAME" << YAML::Value << name;
-    if (auto location = libevdev_get_phys(dev))
-        yaml << YAML::Key << "LOCATION" << YAML::Value << location;
-    if (auto id = libevdev_get_uniq(dev))
-        yaml << YAML::Key << "ID" << YAML::Value << id;
-    if (auto product = libevdev_get_id_product(dev))
-        yaml << YAML::Key << "PRODUCT" << YAML::Value << product;
-    if (auto vendor = libevdev_get_id_vendor(dev))
-        yaml << YAML::Key << "VENDOR" << YAML::Value << vendor;
-    if (auto bustype = libevdev_get_id_bustype(dev)) {
-        if (bus_string.find(bustype) != bus_string.end())
-            yaml << YAML::Key << "BUSTYPE" << YAML::Value
-                 << bus_string[bustype];
-        else
-            yaml << YAML::Key << "BUSTYPE" << YAML::Value << bustype;
+struct virtual_device {
+    std::vector<std::pair<int, std::string>> sources;
+    libevdev *dev          = nullptr;
+    libevdev_uinput *uidev = nullptr;
+    int fd                 = -1;
+    std::unique_ptr<device_state> state;
+    std::vector<input_event> kept;
+
+    ~virtual_device() {
+        if (uidev)
+            libevdev_uinput_destroy(uidev);
+        if (dev)
+            libevdev_free(dev);
+    }
+};
+
+// Same as read_frames for a stream of tagged_input_event records, gathering a
+// frame per virtual device so that each one still gets whole frames in single
+// writes. Records of tags without a virtual device are dropped. Each partial
+// frame has its own deadline, as a busy tag would otherwise hold back the
+// partial frames of the quiet ones.
+template <typename F>
+bool read_tagged_frames(int fd, std::map<uint32_t, virtual_device> &devices,
+                        F emit) {
+    constexpr int64_t partial_frame_timeout = INT64_C(10000000);
+    constexpr size_t capacity               = 1024;
+
+    struct frame {
+        virtual_device *device;
+        std::vector<input_event> events;
+        int64_t deadline;
+    };
+    std::map<uint32_t, frame> frames;
+    for (auto &device : devices) {
+        frames[device.first].device = &device.second;
+        frames[device.first].events.reserve(capacity);
     }
-    if (auto driver_version = libevdev_get_driver_version(dev))
-        yaml << YAML::Key << "DRIVER_VERSION" << YAML::Value << driver_version;
-
-    vector<string> properties;
-
-    if (libevdev_has_property(dev, INPUT_PROP_POINTER))
-        properties.push_back("INPUT_PROP_POINTER");
-    if (libevdev_has_property(dev, INPUT_PROP_DIRECT))
-        properties.push_back("INPUT_PROP_DIRECT");
-    if (libevdev_has_property(dev, INPUT_PROP_BUTTONPAD))
-        properties.push_back("INPUT_PROP_BUTTONPAD");
-    if (libevdev_has_property(dev, INPUT_PROP_SEMI_MT))
-        properties.push_back("INPUT_PROP_SEMI_MT");
-    if (libevdev_has_property(dev, INPUT_PROP_TOPBUTTONPAD))
-        properties.push_back("INPUT_PROP_TOPBUTTONPAD");
-    if (libevdev_has_property(dev, INPUT_PROP_POINTING_STICK))
-        properties.push_back("INPUT_PROP_POINTING_STICK");
-    if (libevdev_has_property(dev, INPUT_PROP_ACCELEROMETER))
-        properties.push_back("INPUT_PROP_ACCELEROMETER");
-
-    if (!properties.empty())
-        yaml << YAML::Key << "PROPERTIES" << YAML::Value << properties;
-
-    int fd = libevdev_get_fd(dev);
-
-    block_type type_mask[blocks_needed(EV_MAX)]   = {};
-    block_type event_mask[blocks_needed(KEY_MAX)] = {};
-    if (ioctl(fd, EVIOCGBIT(0, EV_MAX), type_mask) != -1 &&
-        any_of(type_mask, type_mask + blocks_needed(EV_MAX),
-               [](block_type block) { return block != block_type{}; })) {
-        yaml << YAML::Key << "EVENTS" << YAML::Value;
-        yaml << YAML::BeginMap;
-        for (int type_code = 0; type_code <= EV_MAX; ++type_code) {
-            if (!bit(type_mask, type_code))
+
+    tagged_input_event buffer[capacity];
+    auto bytes    = reinterpret_cast<char *>(buffer);
+    size_t filled = 0, pending = 0;
+
+    auto flush = [&](frame &frame) {
+        pending -= frame.events.size();
+        bool emitted =
+            emit(*frame.device, frame.events.data(), frame.events.size());
+        frame.events.clear();
+        return emitted;
+    };
+    auto flush_all = [&]() {
+        for (auto &frame : frames)
+            if (!frame.second.events.empty() && !flush(frame.second))
+                return false;
+        return true;
+    };
+
+    for (;;) {
+        int64_t now = monotonic_now(), next = INT64_MAX;
+        for (auto &frame : frames) {
+            if (frame.second.events.empty())
                 continue;
-            int event_max         = libevdev_event_type_get_max(type_code);
-            const char *type_name = libevdev_event_type_get_name(type_code);
-            yaml << YAML::Key;
-            if (type_name)
-                yaml << libevdev_event_type_get_name(type_code);
-            else
-                yaml << type_code;
-            yaml << YAML::Value;
-            switch (type_code) {
-                case EV_SYN:
-                    yaml << YAML::Flow << YAML::BeginSeq;
-                    if (libevdev_has_event_code(dev, EV_SYN, SYN_REPORT))
-                        yaml << "SYN_REPORT";
-                    if (libevdev_has_event_code(dev, EV_SYN, SYN_CONFIG))
-                        yaml << "SYN_CONFIG";
-                    if (libevdev_has_event_code(dev, EV_SYN, SYN_MT_REPORT))
-                        yaml << "SYN_MT_REPORT";
-                    if (libevdev_has_event_code(dev, EV_SYN, SYN_DROPPED))
-                        yaml << "SYN_DROPPED";
-                    yaml << YAML::EndSeq;
-                    break;
-                case EV_REP: {
-                    int delay, period;
-                    libevdev_get_repeat(dev, &delay, &period);
-                    yaml << YAML::BeginMap;
-                    yaml << YAML::Key << "REP_DELAY" << YAML::Value << delay;
-                    yaml << YAML::Key << "REP_PERIOD" << YAML::Value << period;
-                    yaml << YAML::EndMap;
-                } break;
-                case EV_ABS:
-                    if (ioctl(fd, EVIOCGBIT(type_code, event_max),
-                              event_mask) != -1) {
-                        yaml << YAML::BeginMap;
-                        for (int event_code = 0; event_code <= event_max;
-                             ++event_code) {
-                            if (!bit(event_mask, event_code))
-                                continue;
-                            if (auto absinfo =
-                                    libevdev_get_abs_info(dev, event_code)) {
-                                if (auto event_name =
-                                        libevdev_event_code_get_name(
-                                            type_code, event_code))
-                                    yaml << YAML::Key << event_name
-                                         << YAML::Value;
-                                else
-                                    yaml << YAML::Key << event_code
-                                         << YAML::Value;
-                                yaml << YAML::BeginMap;
-                                yaml << YAML::Key << "VALUE" << YAML::Value
-                                     << absinfo->value;
-                                yaml << YAML::Key << "MIN" << YAML::Value
-                                     << absinfo->minimum;
-                                yaml << YAML::Key << "MAX" << YAML::Value
-                                     << absinfo->maximum;
-                                if (absinfo->flat > 0)
-                                    yaml << YAML::Key << "FLAT" << YAML::Value
-                                         << absinfo->flat;
-                                if (absinfo->fuzz > 0)
-                                    yaml << YAML::Key << "FUZZ" << YAML::Value
-                                         << absinfo->fuzz;
-                                if (absinfo->resolution > 0)
-                                    yaml << YAML::Key << "RES" << YAML::Value
-                                         << absinfo->resolution;
-                                yaml << YAML::EndMap;
-                            }
-                        }
-                        yaml << YAML::EndMap;
-                    }
-                    break;
-                default:
-                    if (ioctl(fd, EVIOCGBIT(type_code, event_max),
-                              event_mask) != -1) {
-                        yaml << YAML::Flow << YAML::BeginSeq;
-                        for (int event_code = 0; event_code <= event_max;
-                             ++event_code) {
-                            if (!bit(event_mask, event_code))
-                                continue;
-                            if (auto event_name = libevdev_event_code_get_name(
-                                    type_code, event_code))
-                                yaml << event_name;
-                            else
-                                yaml << event_code;
-                        }
-                        yaml << YAML::EndSeq;
-                    }
-                    break;
+            if (frame.second.deadline <= now) {
+                if (!flush(frame.second))
+                    return false;
+            } else {
+                next = std::min(next, frame.second.deadline);
             }
         }
-        yaml << YAML::EndMap;
+
+        if (pending) {
+            pollfd pfd = {fd, POLLIN, 0};
+            int rc = poll(&pfd, 1, int((next - now + 999999) / 1000000));
+            if (rc < 0 && errno != EINTR)
+                return false;
+            if (rc <= 0)
+                continue;
+        }
+
+        ssize_t n = read(fd, bytes + filled, sizeof buffer - filled);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        if (n == 0)
+            return flush_all();
+        filled += n;
+
+        now          = monotonic_now();
+        size_t count = filled / sizeof *buffer;
+        for (size_t i = 0; i < count; ++i) {
+            auto frame = frames.find(buffer[i].tag);
+            if (frame == frames.end())
+                continue;
+            if (frame->second.events.empty())
+                frame->second.deadline = now + partial_frame_timeout;
+            frame->second.events.push_back(buffer[i].event);
+            ++pending;
+            if ((is_frame_end(buffer[i].event) ||
+                 frame->second.events.size() == capacity) &&
+                !flush(frame->second))
+                return false;
+        }
+
+        std::memmove(bytes, bytes + count * sizeof *buffer,
+                     filled - count * sizeof *buffer);
+        filled -= count * sizeof *buffer;
     }
+}
 
-    yaml << YAML::EndMap;
-    return yaml.c_str();
+// Returns a unix stream socket connected to path, or listening on it in place
+// of any stale socket left there, or -1 on error.
+int unix_socket(const char *path, bool listening) {
+    sockaddr_un address = {};
+    address.sun_family  = AF_UNIX;
+    if (std::strlen(path) >= sizeof address.sun_path)
+        return errno = ENAMETOOLONG, -1;
+    std::strcpy(address.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+
+    auto addr = reinterpret_cast<const sockaddr *>(&address);
+    if (listening) {
+        struct stat st;
+        if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+            unlink(path);
+        if (bind(fd, addr, sizeof address) == 0 && listen(fd, SOMAXCONN) == 0)
+            return fd;
+    } else if (connect(fd, addr, sizeof address) == 0)
+        return fd;
+
+    int error = errno;
+    close(fd);
+    return errno = error, -1;
 }
 
-libevdev *evdev_create_from_yaml(const std::vector<YAML::Node> &configs) {
-    using std::map;
-    using std::stoi;
-    using std::vector;
-    using std::string;
-
-    libevdev *dev = libevdev_new();
-
-    for (const auto &config : configs) {
-        if (auto name = config["NAME"])
-            libevdev_set_name(dev, name.as<string>().c_str());
-        if (auto id = config["ID"])
-            libevdev_set_uniq(dev, id.as<string>().c_str());
-        if (auto product = config["PRODUCT"])
-            libevdev_set_id_product(dev, product.as<int>());
-        if (auto vendor = config["VENDOR"])
-            libevdev_set_id_vendor(dev, vendor.as<int>());
-        if (auto bustype = config["BUSTYPE"])
-            libevdev_set_id_bustype(dev, string_bus[bustype.as<string>()]);
-        if (auto version = config["VERSION"])
-            libevdev_set_id_version(dev, version.as<int>());
-        if (auto property = config["PROPERTIES"])
-            for (auto it = property.begin(); it != property.end(); ++it) {
-                auto property =
-                    libevdev_property_from_name(it->as<string>().c_str());
-                if (property != -1)
-                    libevdev_enable_property(dev, property);
-            }
-        if (auto event_types = config["EVENTS"]) {
-            for (const auto &event_type : event_types) {
-                auto event_type_string = event_type.first.as<string>();
-                if (event_type_string == "EV_REP") {
-                    if (auto rep_delay = event_type.second["REP_DELAY"]) {
-                        auto rep_delay_value = rep_delay.as<int>();
-                        libevdev_enable_event_code(dev, EV_REP, REP_DELAY,
-                                                   &rep_delay_value);
-                    }
-                    if (auto rep_period = event_type.second["REP_PERIOD"]) {
-                        auto rep_period_value = rep_period.as<int>();
-                        libevdev_enable_event_code(dev, EV_REP, REP_PERIOD,
-                                                   &rep_period_value);
-                    }
-                } else if (event_type_string == "EV_ABS") {
-                    for (const auto &axis : event_type.second) {
-                        input_absinfo absinfo = {};
-                        if (auto axis_value = axis.second["VALUE"])
-                            absinfo.value = axis_value.as<int>();
-                        if (auto axis_min = axis.second["MIN"])
-                            absinfo.minimum = axis_min.as<int>();
-                        if (auto axis_max = axis.second["MAX"])
-                            absinfo.maximum = axis_max.as<int>();
-                        if (auto axis_flat = axis.second["FLAT"])
-                            absinfo.flat = axis_flat.as<int>();
-                        if (auto fuzz = axis.second["FUZZ"])
-                            absinfo.fuzz = fuzz.as<int>();
-                        if (auto res = axis.second["RES"])
-                            absinfo.resolution = res.as<int>();
-
-                        if (!axis.second["VALUE"] && axis.second["MAX"])
-                            absinfo.value = absinfo.maximum;
-                        if (!axis.second["VALUE"] && axis.second["MIN"])
-                            absinfo.value = absinfo.minimum;
-
-                        auto axis_code = libevdev_event_code_from_name(
-                            EV_ABS, axis.first.as<string>().c_str());
-                        if (axis_code != -1)
-                            libevdev_enable_event_code(dev, EV_ABS, axis_code,
-                                                       &absinfo);
-                    }
-                } else {
-                    auto event_type_code = libevdev_event_type_from_name(
-                        event_type_string.c_str());
-
-                    for (const auto &event : event_type.second) {
-                        auto event_string = event.as<string>();
-                        if (is_int(event_string))
-                            libevdev_enable_event_code(dev, event_type_code,
-                                                       stoi(event_string),
-                                                       nullptr);
-                        else {
-                            auto event_code = libevdev_event_code_from_name(
-                                event_type_code, event_string.c_str());
-                            if (event_code != -1)
-                                libevdev_enable_event_code(dev, event_type_code,
-                                                           event_code, nullptr);
-                        }
-                    }
-                }
-            }
+// Merges sources into a new device, or the description of capture when there
+// are none, going through the cache in cache_dir when given.
+libevdev *create_device(const std::vector<std::pair<int, std::string>> &sources,
+                        const char *cache_dir, const capture &capture) {
+    using std::perror;
+
+    std::string cache_path;
+    if (cache_dir && !sources.empty()) {
+        description_hash hash;
+        bool hashed = true;
+        for (const auto &source : sources)
+            hashed = hashed && (source.first == 'c'
+                                    ? hash.add_file(source.second.c_str())
+                                    : hash.add_device(source.second.c_str()));
+        char name[32];
+        std::snprintf(name, sizeof name, "/%016" PRIx64 ".dev", hash.value());
+        if (hashed)
+            cache_path = cache_dir + std::string(name);
+    }
+
+    libevdev *dev =
+        cache_path.empty() ? nullptr : evdev_create_from_cache(cache_path);
+    if (dev)
+        return dev;
+
+    dev = libevdev_new();
+    struct defer0 {
+        libevdev *dev;
+        ~defer0() {
+            if (dev)
+                libevdev_free(dev);
         }
+    } defer0{dev};
+    for (const auto &source : sources) {
+        if (source.first == 'c') {
+            evdev_merge_from_yaml(dev, YAML::LoadFile(source.second));
+            continue;
+        }
+
+        int fd = open(source.second.c_str(), O_RDONLY);
+        if (fd < 0)
+            return perror("open failed"), nullptr;
+        struct defer1 {
+            int fd;
+            ~defer1() { close(fd); }
+        } defer1{fd};
+        libevdev *reference;
+        if (libevdev_new_from_fd(fd, &reference) < 0)
+            return perror("libevdev_new_from_fd failed"), nullptr;
+        struct defer2 {
+            libevdev *dev;
+            ~defer2() { libevdev_free(dev); }
+        } defer2{reference};
+        evdev_merge_from_evdev(dev, reference);
     }
+    if (sources.empty())
+        evdev_merge_from_yaml(dev, YAML::Load(capture.description));
 
+    if (!cache_path.empty() && !cache_create_from_evdev(cache_path, dev))
+        perror("error writing description cache");
+
+    defer0.dev = nullptr;
     return dev;
 }
 
 int main(int argc, char *argv[]) try {
     using std::perror;
 
-    std::vector<YAML::Node> configs;
-    bool print = false;
-
-    for (int opt; (opt = getopt(argc, argv, "hc:d:p")) != -1;) {
+    std::map<uint32_t, virtual_device> devices;
+    virtual_device *device = &devices[0];
+    bool tagged = false, print = false, measure = false, pace = false,
+         fast = false, skipping = false;
+    int64_t skip = 0;
+    const char *replay = nullptr, *cache_dir = nullptr, *listening = nullptr,
+               *attach = nullptr;
+    realtime rt{};
+
+    static const option long_options[] = {REALTIME_LONG_OPTION, {}};
+    for (int opt; (opt = getopt_long(argc, argv, "hC:s:c:d:pLrR:ft:l:a:",
+                                     long_options, nullptr)) != -1;) {
         switch (opt) {
             case 'h':
                 return print_usage(stdout, argv[0]), EXIT_SUCCESS;
-            case 'c':
-                configs.push_back(YAML::LoadFile(optarg));
+            case 'C':
+                if (cache_dir)
+                    break;
+                cache_dir = optarg;
                 continue;
-            case 'd': {
-                int fd = open(optarg, O_RDONLY);
-                if (fd < 0)
-                    return perror("open failed"), EXIT_FAILURE;
-                struct defer1 {
-                    int fd;
-                    ~defer1() { close(fd); }
-                } defer1{fd};
-                libevdev *dev;
-                if (libevdev_new_from_fd(fd, &dev) < 0)
-                    return perror("libevdev_new_from_fd failed"), EXIT_FAILURE;
-                struct defer2 {
-                    libevdev *dev;
-                    ~defer2() { libevdev_free(dev); }
-                } defer2{dev};
-                configs.push_back(YAML::Load(yaml_create_from_evdev(dev)));
+            case 's': {
+                char *end;
+                errno    = 0;
+                auto tag = std::strtoul(optarg, &end, 10);
+                if (end == optarg || *end || errno || tag > UINT32_MAX ||
+                    (tagged && devices.count(tag)) ||
+                    (!tagged && !device->sources.empty()))
+                    break;
+                if (!tagged)
+                    devices.clear();
+                tagged = true;
+                device = &devices[tag];
                 continue;
             }
+            case 'c':
+            case 'd':
+                device->sources.emplace_back(opt, optarg);
+                continue;
             case 'p':
                 if (print)
                     break;
                 print = true;
                 continue;
+            case 'L':
+                if (measure)
+                    break;
+                measure = true;
+                continue;
+            case 'r':
+                if (pace)
+                    break;
+                pace = true;
+                continue;
+            case 'R':
+                if (replay)
+                    break;
+                replay = optarg;
+                continue;
+            case 'f':
+                if (fast)
+                    break;
+                fast = true;
+                continue;
+            case 't': {
+                char *end;
+                errno = 0;
+                skip  = std::strtoll(optarg, &end, 10);
+                if (skipping || end == optarg || *end || errno || skip < 0 ||
+                    skip > INT64_MAX / 1000)
+                    break;
+                skipping = true;
+                continue;
+            }
+            case 'l':
+                if (listening)
+                    break;
+                listening = optarg;
+                continue;
+            case 'a':
+                if (attach)
+                    break;
+                attach = optarg;
+                continue;
+            case REALTIME_OPTION:
+                if (rt.enabled || realtime_parse(&rt, optarg) < 0)
+                    break;
+                continue;
         }
 
         return print_usage(stderr, argv[0]), EXIT_FAILURE;
     }
 
-    if (configs.empty())
+    if ((pace && replay) || ((fast || skipping) && !replay) ||
+        (tagged && replay) ||
+        (listening && (pace || replay || print)))
         return print_usage(stderr, argv[0]), EXIT_FAILURE;
 
-    libevdev *dev = evdev_create_from_yaml(configs);
-    struct defer1 {
-        libevdev *dev;
-        ~defer1() { libevdev_free(dev); }
-    } defer1{dev};
-    libevdev_uinput *uidev;
-    if (libevdev_uinput_create_from_device(dev, LIBEVDEV_UINPUT_OPEN_MANAGED,
-                                           &uidev) < 0)
-        return perror("libevdev_uinput_create_from_device failed"),
-               EXIT_FAILURE;
-    struct defer2 {
-        libevdev_uinput *uidev;
-        ~defer2() { libevdev_uinput_destroy(uidev); }
-    } defer2{uidev};
+    if (attach) {
+        if (tagged || print || measure || pace || replay || cache_dir ||
+            listening || rt.enabled || !device->sources.empty())
+            return print_usage(stderr, argv[0]), EXIT_FAILURE;
 
-    if (print) {
-        int fd = open(libevdev_uinput_get_devnode(uidev), O_RDONLY);
+        int fd = unix_socket(attach, false);
         if (fd < 0)
-            return perror("open failed"), EXIT_FAILURE;
-        struct defer1 {
+            return perror("connect failed"), EXIT_FAILURE;
+        struct defer0 {
             int fd;
-            ~defer1() { close(fd); }
-        } defer1{fd};
-        libevdev *dev;
-        if (libevdev_new_from_fd(fd, &dev) < 0)
-            return perror("libevdev_new_from_fd failed"), EXIT_FAILURE;
-        struct defer2 {
+            ~defer0() { close(fd); }
+        } defer0{fd};
+
+        char buffer[1024 * sizeof(tagged_input_event)];
+        for (;;) {
+            ssize_t n = read(STDIN_FILENO, buffer, sizeof buffer);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0)
+                return perror("error reading stdin"), EXIT_FAILURE;
+            if (n == 0)
+                return EXIT_SUCCESS;
+            if (!write_all(fd, buffer, n))
+                return perror("error writing to socket"), EXIT_FAILURE;
+        }
+    }
+
+    capture capture{};
+    struct defer0 {
+        struct capture *capture;
+        ~defer0() { capture_close(capture); }
+    } defer0{&capture};
+    if (replay && capture_open(&capture, replay) < 0)
+        return perror("capture_open failed"), EXIT_FAILURE;
+
+    for (auto &device : devices) {
+        if (device.second.sources.empty() && !replay)
+            return print_usage(stderr, argv[0]), EXIT_FAILURE;
+
+        device.second.dev =
+            create_device(device.second.sources, cache_dir, capture);
+        if (!device.second.dev)
+            return EXIT_FAILURE;
+        if (libevdev_uinput_create_from_device(device.second.dev,
+                                               LIBEVDEV_UINPUT_OPEN_MANAGED,
+                                               &device.second.uidev) < 0)
+            return perror("libevdev_uinput_create_from_device failed"),
+                   EXIT_FAILURE;
+        device.second.fd = libevdev_uinput_get_fd(device.second.uidev);
+        device.second.state.reset(new device_state(device.second.dev));
+    }
+
+    if (print) {
+        for (auto &device : devices) {
+            const char *devnode =
+                libevdev_uinput_get_devnode(device.second.uidev);
+            int fd = open(devnode, O_RDONLY);
+            if (fd < 0)
+                return perror("open failed"), EXIT_FAILURE;
+            struct defer1 {
+                int fd;
+                ~defer1() { close(fd); }
+            } defer1{fd};
             libevdev *dev;
-            ~defer2() { libevdev_free(dev); }
-        } defer2{dev};
-        return puts(yaml_create_from_evdev(dev).c_str()), EXIT_SUCCESS;
+            if (libevdev_new_from_fd(fd, &dev) < 0)
+                return perror("libevdev_new_from_fd failed"), EXIT_FAILURE;
+            struct defer2 {
+                libevdev *dev;
+                ~defer2() { libevdev_free(dev); }
+            } defer2{dev};
+            if (tagged)
+                std::printf("--- # %" PRIu32 "\n", device.first);
+            puts(yaml_create_from_evdev(dev).c_str());
+        }
+        return EXIT_SUCCESS;
+    }
+
+    if (measure)
+        latency_init(argv[0]);
+
+    realtime_apply(&rt);
+
+    pacer pacing;
+    if (pace || (replay && !fast))
+        prctl(PR_SET_TIMERSLACK, 1);
+
+    auto emit = [&](virtual_device &device, const input_event *events,
+                    size_t count) {
+        const input_event &last = events[count - 1];
+        if (pace && is_frame_end(last))
+            pacing.wait(last.input_event_sec * INT64_C(1000000) +
+                        last.input_event_usec);
+        if (device.kept.size() < count)
+            device.kept.resize(count);
+        count  = device.state->filter(events, count, device.kept.data());
+        events = device.kept.data();
+        if (!write_all(device.fd, events, count * sizeof *events))
+            return false;
+        if (measure)
+            for (size_t i = 0; i < count; ++i)
+                latency_record(events[i].input_event_sec,
+                               events[i].input_event_usec);
+        return true;
+    };
+
+    if (replay) {
+        int64_t start  = monotonic_now();
+        uint64_t first = 0;
+        if (skipping && capture.frame_count) {
+            uint64_t frame = capture_find_frame(
+                &capture, capture.frames[0].time + skip * 1000);
+            first = frame < capture.frame_count ? capture.frames[frame].first
+                                                : capture.event_count;
+        }
+        uint64_t begin = first;
+        std::vector<input_event> frame;
+        for (uint64_t i = first; i < capture.event_count; ++i) {
+            const capture_event &event = capture.events[i];
+            if (event.type != EV_SYN || event.code != SYN_REPORT)
+                continue;
+            for (frame.clear(); first <= i; ++first) {
+                const capture_event &event = capture.events[first];
+                input_event input          = {};
+                input.input_event_sec      = event.time / 1000000;
+                input.input_event_usec     = event.time % 1000000;
+                input.type                 = event.type;
+                input.code                 = event.code;
+                input.value                = event.value;
+                frame.push_back(input);
+            }
+            if (!fast)
+                pacing.wait(event.time);
+            if (!emit(*device, frame.data(), frame.size()))
+                return perror("write to virtual device failed"), EXIT_FAILURE;
+        }
+        if (fast)
+            std::fprintf(stderr,
+                         "%" PRIu64 " events replayed in %" PRId64 "us\n",
+                         first - begin, (monotonic_now() - start) / 1000);
+        return EXIT_SUCCESS;
+    }
+
+    if (listening) {
+        int listener = unix_socket(listening, true);
+        if (listener < 0)
+            return perror("listen failed"), EXIT_FAILURE;
+
+        // a thread per writer, each gathering its own frames, so that one
+        // writer can take over before another is gone. The keys a writer
+        // leaves pressed get released when it goes, and the threads are
+        // joined before leaving, as they share the state of main.
+        struct writer {
+            int fd;
+            std::thread thread;
+            bool done = false;
+        };
+        struct held_keys {
+            std::bitset<KEY_CNT> keys;
+            input_event last;
+        };
+        std::mutex mutex;
+        std::list<writer> writers;
+        auto serve = [&](writer &writer) {
+            std::map<virtual_device *, held_keys> held;
+            auto locked_emit = [&](virtual_device &device,
+                                   const input_event *events, size_t count) {
+                std::lock_guard<std::mutex> lock(mutex);
+                held_keys &device_held = held[&device];
+                for (size_t i = 0; i < count; ++i)
+                    if (events[i].type == EV_KEY && events[i].code < KEY_CNT)
+                        device_held.keys[events[i].code] = events[i].value;
+                device_held.last = events[count - 1];
+                return emit(device, events, count);
+            };
+            if (tagged ? !read_tagged_frames(writer.fd, devices, locked_emit)
+                       : !read_frames(writer.fd, [&](const input_event *events,
+                                                     size_t count) {
+                             return locked_emit(*device, events, count);
+                         }))
+                perror("error forwarding input events");
+
+            std::lock_guard<std::mutex> lock(mutex);
+            for (auto &device_held : held) {
+                std::vector<input_event> release;
+                input_event event = device_held.second.last;
+                for (int code = 0; code < KEY_CNT; ++code)
+                    if (device_held.second.keys[code]) {
+                        event.type  = EV_KEY;
+                        event.code  = code;
+                        event.value = 0;
+                        release.push_back(event);
+                    }
+                if (release.empty())
+                    continue;
+                event.type  = EV_SYN;
+                event.code  = SYN_REPORT;
+                event.value = 0;
+                release.push_back(event);
+                if (!emit(*device_held.first, release.data(), release.size()))
+                    perror("error releasing keys of writer");
+            }
+            close(writer.fd);
+            writer.done = true;
+        };
+
+        for (;;) {
+            int fd = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+            if (fd < 0) {
+                if (errno == EINTR || errno == ECONNABORTED)
+                    continue;
+                perror("accept failed");
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    for (auto &writer : writers)
+                        if (!writer.done)
+                            shutdown(writer.fd, SHUT_RDWR);
+                }
+                for (auto &writer : writers)
+                    writer.thread.join();
+                return EXIT_FAILURE;
+            }
+
+            std::lock_guard<std::mutex> lock(mutex);
+            for (auto writer = writers.begin(); writer != writers.end();)
+                if (writer->done) {
+                    writer->thread.join();
+                    writer = writers.erase(writer);
+                } else {
+                    ++writer;
+                }
+            writers.emplace_back();
+            writer &added = writers.back();
+            added.fd      = fd;
+            added.thread  = std::thread(serve, std::ref(added));
+        }
     }
 
-    std::setbuf(stdin, nullptr);
-    input_event input;
-    while (fread(&input, sizeof input, 1, stdin) == 1)
-        if (libevdev_uinput_write_event(uidev, input.type, input.code,
-                                        input.value) < 0)
-            return perror("libevdev_uinput_write_event failed"), EXIT_FAILURE;
+    if (tagged ? !read_tagged_frames(STDIN_FILENO, devices, emit)
+               : !read_frames(STDIN_FILENO,
+                              [&](const input_event *events, size_t count) {
+                                  return emit(*device, events, count);
+                              }))
+        return perror("error forwarding input events"), EXIT_FAILURE;
 } catch (const std::exception &e) {
     return std::fprintf(stderr,
                         R"(an exception occurred: "%s")"
@@ -0,0 +1,155 @@
+#include <errno.h>
+#include <string.h>
+
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "uring.h"
+
+static unsigned load_acquire(const unsigned *p) {
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static void store_release(unsigned *p, unsigned value) {
+    __atomic_store_n(p, value, __ATOMIC_RELEASE);
+}
+
+static void *map_ring(int fd, size_t size, off_t offset) {
+    void *p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, fd, offset);
+    return p == MAP_FAILED ? NULL : p;
+}
+
+int uring_init(struct uring *ring, unsigned entries, int sqpoll) {
+    memset(ring, 0, sizeof *ring);
+
+    struct io_uring_params params = {0};
+    if (sqpoll) {
+        params.flags          = IORING_SETUP_SQPOLL;
+        params.sq_thread_idle = 1000;
+    }
+
+    ring->fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (ring->fd < 0)
+        return -1;
+
+    // reads and writes rely on offset -1 meaning the current file position
+    if (!(params.features & IORING_FEAT_RW_CUR_POS)) {
+        close(ring->fd);
+        errno = ENOSYS;
+        return -1;
+    }
+
+    ring->flags        = params.flags;
+    ring->sq_entries   = params.sq_entries;
+    ring->sq_ring_size =
+        params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size =
+        params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_ring_size > ring->sq_ring_size)
+            ring->sq_ring_size = ring->cq_ring_size;
+        ring->cq_ring_size = 0;
+    }
+
+    ring->sq_ring = map_ring(ring->fd, ring->sq_ring_size, IORING_OFF_SQ_RING);
+    if (!ring->sq_ring)
+        goto teardown;
+    ring->cq_ring = ring->cq_ring_size ? map_ring(ring->fd, ring->cq_ring_size,
+                                                  IORING_OFF_CQ_RING)
+                                       : ring->sq_ring;
+    if (!ring->cq_ring)
+        goto teardown;
+    ring->sqes = map_ring(ring->fd, ring->sqes_size, IORING_OFF_SQES);
+    if (!ring->sqes)
+        goto teardown;
+
+    char *sq = ring->sq_ring, *cq = ring->cq_ring;
+    ring->sq_head  = (unsigned *)(sq + params.sq_off.head);
+    ring->sq_tail  = (unsigned *)(sq + params.sq_off.tail);
+    ring->sq_mask  = (unsigned *)(sq + params.sq_off.ring_mask);
+    ring->sq_flags = (unsigned *)(sq + params.sq_off.flags);
+    ring->cq_head  = (unsigned *)(cq + params.cq_off.head);
+    ring->cq_tail  = (unsigned *)(cq + params.cq_off.tail);
+    ring->cq_mask  = (unsigned *)(cq + params.cq_off.ring_mask);
+    ring->cqes     = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+    unsigned *array = (unsigned *)(sq + params.sq_off.array);
+    for (unsigned i = 0; i < params.sq_entries; ++i)
+        array[i] = i;
+    ring->sq_local_tail = *ring->sq_tail;
+
+    return 0;
+
+teardown:
+    uring_exit(ring);
+    return -1;
+}
+
+void uring_exit(struct uring *ring) {
+    if (ring->sqes)
+        munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_ring && ring->cq_ring != ring->sq_ring)
+        munmap(ring->cq_ring, ring->cq_ring_size);
+    if (ring->sq_ring)
+        munmap(ring->sq_ring, ring->sq_ring_size);
+    close(ring->fd);
+}
+
+int uring_register_buffers(struct uring *ring, const struct iovec *buffers,
+                           unsigned count) {
+    return syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_BUFFERS,
+                   buffers, count);
+}
+
+int uring_register_files(struct uring *ring, const int *fds, unsigned count) {
+    return syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_FILES,
+                   fds, count);
+}
+
+struct io_uring_sqe *uring_get_sqe(struct uring *ring) {
+    if (ring->sq_local_tail - load_acquire(ring->sq_head) >= ring->sq_entries)
+        return NULL;
+
+    struct io_uring_sqe *sqe =
+        &ring->sqes[ring->sq_local_tail++ & *ring->sq_mask];
+    memset(sqe, 0, sizeof *sqe);
+
+    return sqe;
+}
+
+// Publishes the prepared entries and, when wait is set, blocks until at least
+// one completion is available. With SQPOLL the kernel thread picks entries up
+// by itself, so no syscall happens unless it has to be woken or we must wait.
+int uring_submit(struct uring *ring, unsigned wait) {
+    unsigned submitted = ring->sq_local_tail - load_acquire(ring->sq_head);
+    store_release(ring->sq_tail, ring->sq_local_tail);
+
+    unsigned flags = wait ? IORING_ENTER_GETEVENTS : 0;
+    if (ring->flags & IORING_SETUP_SQPOLL) {
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (load_acquire(ring->sq_flags) & IORING_SQ_NEED_WAKEUP)
+            flags |= IORING_ENTER_SQ_WAKEUP;
+        else if (!wait)
+            return 0;
+    } else if (!submitted && !wait)
+        return 0;
+
+    return syscall(__NR_io_uring_enter, ring->fd, submitted, wait, flags,
+                   NULL, 0);
+}
+
+struct io_uring_cqe *uring_peek_cqe(struct uring *ring) {
+    unsigned head = *ring->cq_head;
+    if (head == load_acquire(ring->cq_tail))
+        return NULL;
+
+    return &ring->cqes[head & *ring->cq_mask];
+}
+
+void uring_cqe_seen(struct uring *ring) {
+    store_release(ring->cq_head, *ring->cq_head + 1);
+}
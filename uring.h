@@ -0,0 +1,38 @@
+#ifndef INTERCEPTION_URING_H
+#define INTERCEPTION_URING_H
+
+#include <sys/uio.h>
+
+#include <linux/io_uring.h>
+
+// Bare io_uring instance set up through the raw syscalls, with its rings
+// mapped and the submission array laid out one to one with the entries.
+struct uring {
+    int fd;
+    unsigned flags;
+
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_flags;
+    unsigned sq_entries, sq_local_tail;
+    struct io_uring_sqe *sqes;
+
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    void *sq_ring, *cq_ring;
+    size_t sq_ring_size, cq_ring_size, sqes_size;
+};
+
+int uring_init(struct uring *ring, unsigned entries, int sqpoll);
+void uring_exit(struct uring *ring);
+
+int uring_register_buffers(struct uring *ring, const struct iovec *buffers,
+                           unsigned count);
+int uring_register_files(struct uring *ring, const int *fds, unsigned count);
+
+struct io_uring_sqe *uring_get_sqe(struct uring *ring);
+int uring_submit(struct uring *ring, unsigned wait);
+
+struct io_uring_cqe *uring_peek_cqe(struct uring *ring);
+void uring_cqe_seen(struct uring *ring);
+
+#endif